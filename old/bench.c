@@ -0,0 +1,862 @@
+/*
+ * pico-bench: times the monitor/tab/client primitives of pico.c without
+ * an X server.  pico.c is compiled into this file with its main() and
+ * logging removed, against the null backend (../x11/null.h), which
+ * counts the window requests instead of sending them.
+ *
+ * A second table replays relayouts against simulated clients that carry
+ * WM_NORMAL_HINTS and answer unacceptable sizes with a ConfigureRequest,
+ * counting how many configure round trips each relayout costs.
+ *
+ * The last table sets the same layout, walk and lookup against the
+ * index-based model of ../pico.c (bench_core.c), warm and with the caches
+ * flushed before each op.  Cache misses come from perf_event_open() where
+ * the kernel allows it.
+ *
+ * The event table runs a client's whole life (map, retitle, configure,
+ * enter, destroy) through dispatch() and reports the requests and round
+ * trips each handler made; pico-bench exits non-zero if one goes over
+ * its entry in rt_budget[].  WM_CLASS values as clients write them are
+ * then parsed, and a wrong instance or class fails the run the same way.
+ *
+ * The scroll table puts every client of a tab on the scrolling layout and
+ * steps the view across the strip and back, reporting the requests of
+ * the first (full) pass and of each step.  The view row then tags every
+ * other client 2 and switches the tab between the views 1 and 1|2.
+ *
+ * The snapshot table times snap_flush() into a private buffer: once with
+ * nothing changed, when it returns at once, and once per moved client.
+ *
+ * The burst table feeds synthetic events through the EVENT_THREAD ring
+ * at a fixed rate while the main side runs m_update() after each batch,
+ * and reports whether the reader ever had to stop draining.
+ */
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static uint64_t n_alloc;
+
+/* real configures seen by the simulated clients, see sim_settle() */
+#define SIM_MAX		(1 << 16)
+
+static struct {
+	unsigned long win;
+	unsigned int w, h;
+} sim_cfg[SIM_MAX];
+static uint64_t sim_cfg_cnt;
+
+static void sim_record(unsigned long win, unsigned int w, unsigned int h)
+{
+	if (sim_cfg_cnt < SIM_MAX) {
+		sim_cfg[sim_cfg_cnt].win = win;
+		sim_cfg[sim_cfg_cnt].w = w;
+		sim_cfg[sim_cfg_cnt].h = h;
+		sim_cfg_cnt++;
+	}
+}
+
+#define BE_NULL_ON_CONFIGURE(win, w, h)	sim_record(win, w, h)
+
+static void *bench_calloc(size_t n, size_t sz)
+{
+	n_alloc++;
+	return calloc(n, sz);
+}
+
+static void *bench_realloc(void *p, size_t sz)
+{
+	n_alloc++;
+	return realloc(p, sz);
+}
+
+#define calloc(n, sz)	bench_calloc(n, sz)
+#define realloc(p, sz)	bench_realloc(p, sz)
+
+#include "pico.c"
+
+#undef calloc
+#undef realloc
+
+#define BENCH_MIN_NS	20000000ULL	/* run each op for at least 20ms */
+#define SIM_ROUNDS	8		/* give up on a ping-pong after this */
+#define SIM_RELAYOUTS	16
+#define COLD_RUNS	16
+#define COLD_BYTES	(64 << 20)	/* larger than any last-level cache */
+#define BURST_EVENTS	200000
+#define BURST_GAP_NS	5000		/* 200k events/s */
+#define EVENT_LIVES	1000
+#define SCROLL_STEPS	64
+#define VIEW_STEPS	64
+#define SNAP_STEPS	256
+
+/* round trips a handler may make per event before the bench fails */
+static const struct {
+	int type;
+	uint64_t rt_max;
+} rt_budget[] = {
+	{ MapRequest,		2 },	/* the pipelined query, the final sync */
+	{ PropertyNotify,	0 },
+	{ ConfigureRequest,	0 },
+	{ EnterNotify,		0 },
+	{ DestroyNotify,	0 },
+};
+
+static struct {
+	struct mon *mon;
+	struct tab *tab;
+	struct cli **clis;
+	uint64_t cli_cnt;
+	struct cli *probe;
+	struct tab *probe_tab;
+	uint32_t seed;
+} world;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t rnd(void)
+{
+	world.seed = world.seed * 1103515245u + 12345u;
+	return world.seed >> 8;
+}
+
+static void world_init(uint64_t n, uint64_t n_tab)
+{
+	struct cli *c;
+	uint64_t i;
+
+	memset(&runtime, 0, sizeof(runtime));
+	memset(&world, 0, sizeof(world));
+	world.seed = 1;
+
+	m_init(NULL, None, 0, 0, 1920, 1080);
+	world.mon = runtime.mons;
+	world.tab = world.mon->tab_sel;
+
+	world.clis = malloc(n * sizeof(*world.clis));
+	for (i = 0; i < n; i++) {
+		c = calloc(1, sizeof(*c));
+		c->win = i + 1;
+		c->is_tile = true;
+		c_attach_t(c, world.tab);
+		c_til_append(c, world.tab);
+		world.clis[i] = c;
+	}
+	world.cli_cnt = n;
+
+	world.probe = calloc(1, sizeof(*world.probe));
+	world.probe->win = n + 1;
+
+	for (i = 1; i < n_tab; i++)
+		world.probe_tab = t_init(world.mon);
+
+	m_update(world.mon);
+}
+
+static void world_free(void)
+{
+	struct mon *m, *m_next;
+	struct tab *t, *t_next;
+	struct cli *c, *c_next;
+
+	for (m = runtime.mons; m; m = m_next) {
+		m_next = m->next;
+		for (t = m->tabs; t; t = t_next) {
+			t_next = t->next;
+			for (c = t->clis; c; c = c_next) {
+				c_next = c->next;
+				free(c);
+			}
+			free(t->clis_til);
+			free(t->clis_vis);
+			free(t);
+		}
+		free(m);
+	}
+
+	free(world.probe);
+	free(world.clis);
+	memset(&runtime, 0, sizeof(runtime));
+}
+
+static void op_attach_detach_t(void)
+{
+	c_attach_t(world.probe, world.tab);
+	c_detach_t(world.probe);
+}
+
+static void op_til_append_remove(void)
+{
+	c_til_append(world.probe, world.tab);
+	c_til_remove(world.probe);
+}
+
+static void op_fetch(void)
+{
+	c_fetch(world.clis[rnd() % world.cli_cnt]->win);
+}
+
+static void op_attach_detach_m(void)
+{
+	t_detach_m(world.probe_tab);
+	t_attach_m(world.probe_tab, world.mon);
+}
+
+static void op_t_move(void)
+{
+	t_move(world.probe_tab, 1);
+}
+
+static void op_m_update(void)
+{
+	m_update(world.mon);
+}
+
+static const struct {
+	const char *name;
+	void (*func)(void);
+	bool need_tabs;
+} ops[] = {
+	{ "c_attach_t+c_detach_t",	op_attach_detach_t,	false },
+	{ "c_til_append+c_til_remove",	op_til_append_remove,	false },
+	{ "c_fetch",			op_fetch,		false },
+	{ "t_attach_m+t_detach_m",	op_attach_detach_m,	true },
+	{ "t_move",			op_t_move,		true },
+	{ "m_update",			op_m_update,		false },
+};
+
+static void bench_op(unsigned int i, uint64_t n)
+{
+	uint64_t iters, k, t0, dt, alloc0, xreq0;
+
+	world_init(n, ops[i].need_tabs ? n : 1);
+
+	iters = 1;
+	for (;;) {
+		alloc0 = n_alloc;
+		xreq0 = be_null.req;
+		t0 = now_ns();
+		for (k = 0; k < iters; k++)
+			ops[i].func();
+		dt = now_ns() - t0;
+
+		if (dt >= BENCH_MIN_NS)
+			break;
+		iters *= 2;
+	}
+
+	printf("%-28s %8lu %12.1f %10.2f %10.2f\n", ops[i].name, n,
+		(double)dt / iters,
+		(double)(n_alloc - alloc0) / iters,
+		(double)(be_null.req - xreq0) / iters);
+
+	world_free();
+}
+
+/* terminal-like hints: 7x13 cells plus a 4px base */
+static void sim_hints(struct cli *c)
+{
+	c->props.basew = c->props.baseh = 4;
+	c->props.incw = 7;
+	c->props.inch = 13;
+	c->props.minw = 4 + 7;
+	c->props.minh = 4 + 13;
+}
+
+/*
+ * Plays the clients' side: every configure that is not a whole number of
+ * cells is answered with a request for the size the client would rather
+ * have, exactly like xterm does.  Returns the number of rounds needed.
+ */
+static unsigned int sim_settle(uint64_t *n_req)
+{
+	XEvent ev;
+	struct cli *c;
+	uint64_t i, n, n_req0;
+	unsigned int round, w, h;
+
+	for (round = 0; sim_cfg_cnt && round < SIM_ROUNDS; round++) {
+		n = sim_cfg_cnt;
+		sim_cfg_cnt = 0;
+		n_req0 = *n_req;
+
+		for (i = 0; i < n; i++) {
+			c = world.clis[sim_cfg[i].win - 1];
+			w = sim_cfg[i].w - (sim_cfg[i].w - 4) % 7;
+			h = sim_cfg[i].h - (sim_cfg[i].h - 4) % 13;
+			if (w == sim_cfg[i].w && h == sim_cfg[i].h)
+				continue;
+
+			memset(&ev, 0, sizeof(ev));
+			ev.xconfigurerequest.type = ConfigureRequest;
+			ev.xconfigurerequest.window = c->win;
+			ev.xconfigurerequest.value_mask = CWWidth | CWHeight;
+			ev.xconfigurerequest.width = w;
+			ev.xconfigurerequest.height = h;
+			handle_configurerequest(&ev);
+			(*n_req)++;
+		}
+
+		if (*n_req == n_req0)
+			break;
+	}
+
+	return round;
+}
+
+static void bench_configure(uint64_t n)
+{
+	uint64_t i, k, xreq0, syn0, n_req = 0;
+	unsigned int rounds = 0;
+
+	world_init(n, 1);
+	for (i = 0; i < n; i++)
+		sim_hints(world.clis[i]);
+
+	xreq0 = be_null.req;
+	syn0 = be_null.send;
+	for (k = 0; k < SIM_RELAYOUTS; k++) {
+		world.mon->w = (k & 1) ? 1920 : 1600;
+		sim_cfg_cnt = 0;
+		m_update(world.mon);
+		rounds += sim_settle(&n_req);
+	}
+
+	printf("%-28s %8lu %10.2f %10.2f %10.2f %10.2f\n", "relayout", n,
+		(double)(be_null.req - xreq0 - (be_null.send - syn0)) /
+			SIM_RELAYOUTS,
+		(double)(be_null.send - syn0) / SIM_RELAYOUTS,
+		(double)n_req / SIM_RELAYOUTS,
+		(double)rounds / SIM_RELAYOUTS);
+
+	world_free();
+}
+
+static void event_send(int type, Window win)
+{
+	XEvent ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = type;
+	ev.xany.window = win;
+	switch (type) {
+	case PropertyNotify:
+		ev.xproperty.atom = XA_WM_NAME;
+		ev.xproperty.state = PropertyNewValue;
+		break;
+	case ConfigureRequest:
+		ev.xconfigurerequest.value_mask = CWWidth | CWHeight;
+		ev.xconfigurerequest.width = 500;
+		ev.xconfigurerequest.height = 300;
+		break;
+	case EnterNotify:
+		ev.xcrossing.mode = NotifyNormal;
+		ev.xcrossing.detail = NotifyNonlinear;
+		break;
+	}
+	dispatch(&ev);
+}
+
+/* returns false if a handler went over its round-trip budget */
+static bool bench_events(uint64_t n)
+{
+	const struct acct *a;
+	Window win;
+	uint64_t k;
+	unsigned int i;
+	bool is_ok = true, is_over;
+
+	world_init(n, 1);
+	/* handlers check for a display; the null backend never uses it */
+	world.mon->display = (Display *)&world;
+	handle_init();
+	rules_init();
+
+	for (k = 0; k < EVENT_LIVES; k++) {
+		win = n + 2 + k;
+		event_send(MapRequest, win);
+		event_send(PropertyNotify, win);
+		event_send(ConfigureRequest, win);
+		event_send(EnterNotify, win);
+		event_send(DestroyNotify, win);
+	}
+
+	for (i = 0; i < sizeof(rt_budget) / sizeof(*rt_budget); i++) {
+		a = &runtime.acct[rt_budget[i].type];
+		is_over = a->rt_max > rt_budget[i].rt_max;
+		is_ok = is_ok && !is_over;
+		printf("%-20s %8lu %10.2f %10lu %10.2f %10lu %10lu %s\n",
+			trace_ev_names[rt_budget[i].type], n,
+			a->cnt ? (double)a->req / a->cnt : 0.0,
+			(unsigned long)a->req_max,
+			a->cnt ? (double)a->rt / a->cnt : 0.0,
+			(unsigned long)a->rt_max,
+			(unsigned long)rt_budget[i].rt_max,
+			is_over ? "OVER BUDGET" : "");
+	}
+	printf("\n");
+
+	world_free();
+	return is_ok;
+}
+
+static const struct {
+	const char *val;
+	int len;
+	const char *instance, *class;
+} class_cases[] = {
+	{ "xterm\0XTerm\0", 12, "xterm", "XTerm" },
+	{ "gimp\0Gimp", 9, "gimp", "Gimp" },
+	{ "solo", 4, "solo", "" },
+	{ "\0Anon\0", 6, "", "Anon" },
+	{ "a-very-long-instance-name-that-runs-past-the-sixty-three-byte-cut"
+	  "\0Long\0", 71,
+	  "a-very-long-instance-name-that-runs-past-the-sixty-three-byte-c",
+	  "Long" },
+};
+
+/* props_class() against replies laid out as xcb hands them over */
+static bool bench_class(void)
+{
+	static union {
+		xcb_get_property_reply_t r;
+		char buf[sizeof(xcb_get_property_reply_t) + 128];
+	} u;
+	struct props p;
+	unsigned int i;
+	bool is_ok = true, is_bad;
+
+	for (i = 0; i < sizeof(class_cases) / sizeof(*class_cases); i++) {
+		memset(&u, 0xff, sizeof(u));
+		u.r.format = 8;
+		u.r.value_len = class_cases[i].len;
+		memcpy(&u.r + 1, class_cases[i].val, class_cases[i].len);
+		props_class(&p, &u.r);
+
+		is_bad = strcmp(p.instance, class_cases[i].instance) ||
+			strcmp(p.class, class_cases[i].class);
+		is_ok = is_ok && !is_bad;
+		if (is_bad)
+			printf("WM_CLASS case %u: instance '%s' class '%s' "
+				"WRONG\n", i, p.instance, p.class);
+	}
+	printf("%-20s %8lu cases %s\n\n", "WM_CLASS",
+		(unsigned long)i, is_ok ? "ok" : "FAILED");
+	return is_ok;
+}
+
+static void bench_scroll(uint64_t n)
+{
+	uint64_t k, steps, req0, full, t0;
+
+	world_init(n, 1);
+	world.tab->layout = LAYOUT_SCROLL;
+
+	req0 = be_null.req;
+	m_update(world.mon);
+	full = be_null.req - req0;
+
+	steps = n - SCROLL_COLS < SCROLL_STEPS ? n - SCROLL_COLS : SCROLL_STEPS;
+	req0 = be_null.req;
+	t0 = now_ns();
+	for (k = 0; k < steps; k++)
+		t_scroll(world.tab, 1);
+	for (k = 0; k < steps; k++)
+		t_scroll(world.tab, -1);
+	t0 = now_ns() - t0;
+
+	printf("%-20s %8lu %10lu %10.2f %10.1f\n", "scroll", n,
+		(unsigned long)full,
+		steps ? (double)(be_null.req - req0) / (2 * steps) : 0.0,
+		steps ? (double)t0 / (2 * steps) : 0.0);
+
+	world_free();
+}
+
+static void bench_view(uint64_t n)
+{
+	uint64_t i, k, req0, t0;
+
+	world_init(n, 1);
+	t_view(world.tab, 1 | 2);
+	for (i = 1; i < n; i += 2)
+		world.clis[i]->tags = 2;
+
+	req0 = be_null.req;
+	t0 = now_ns();
+	for (k = 0; k < VIEW_STEPS; k++) {
+		t_view(world.tab, 1);
+		t_view(world.tab, 1 | 2);
+	}
+	t0 = now_ns() - t0;
+
+	printf("%-20s %8lu %10s %10.2f %10.1f\n", "view", n, "-",
+		(double)(be_null.req - req0) / (2 * VIEW_STEPS),
+		(double)t0 / (2 * VIEW_STEPS));
+
+	world_free();
+}
+
+static void bench_snap(uint64_t n)
+{
+	uint64_t k, t_same, t_moved;
+	uint32_t seq;
+
+	world_init(n, 1);
+	snap.map = calloc(1, PS_SIZE);
+	snap.buf = malloc(PS_SIZE);
+	runtime.is_snap_dirty = true;
+	snap_flush();
+	seq = snap.map->seq;
+
+	t_same = now_ns();
+	for (k = 0; k < SNAP_STEPS; k++)
+		snap_flush();
+	t_same = now_ns() - t_same;
+
+	t_moved = now_ns();
+	for (k = 0; k < SNAP_STEPS; k++) {
+		world.clis[k % n]->x++;
+		runtime.is_snap_dirty = true;
+		snap_flush();
+	}
+	t_moved = now_ns() - t_moved;
+
+	printf("%-20s %8lu %10u %10.1f %10.1f %10lu\n", "snapshot", n,
+		snap.map->size, (double)t_same / SNAP_STEPS,
+		(double)t_moved / SNAP_STEPS,
+		(unsigned long)(snap.map->seq - seq) / 2);
+
+	free(snap.map);
+	free(snap.buf);
+	snap.map = NULL;
+	snap.buf = NULL;
+	world_free();
+}
+
+void core_world_init(uint64_t n);
+void core_world_free(void);
+void core_relayout(int w);
+uint64_t core_walk(void);
+uint32_t core_fetch(uint32_t win);
+size_t core_cli_size(void);
+
+static volatile uint64_t sink;
+static unsigned char *cold_buf;
+static int perf_fd = -1;
+
+static void perf_open(void)
+{
+	struct perf_event_attr pe;
+
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof(pe);
+	pe.config = PERF_COUNT_HW_CACHE_MISSES;
+	pe.disabled = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	perf_fd = syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+static uint64_t perf_read(void)
+{
+	uint64_t v = 0;
+
+	if (perf_fd < 0 || read(perf_fd, &v, sizeof(v)) != sizeof(v))
+		return 0;
+	return v;
+}
+
+static void cold_evict(void)
+{
+	size_t i;
+
+	if (!cold_buf && !(cold_buf = malloc(COLD_BYTES)))
+		return;
+	for (i = 0; i < COLD_BYTES; i += 64)
+		cold_buf[i]++;
+}
+
+static void old_init(uint64_t n)
+{
+	world_init(n, 1);
+}
+
+static void old_relayout(uint64_t k)
+{
+	world.mon->w = (k & 1) ? 1920 : 1600;
+	m_update(world.mon);
+}
+
+static void old_walk(uint64_t k)
+{
+	struct cli *c;
+	uint64_t sum = 0;
+
+	for (c = world.tab->clis; c; c = c->next)
+		sum += c->x + c->w;
+	sink = sum;
+}
+
+static void old_fetch(uint64_t k)
+{
+	sink = (uint64_t)c_fetch(rnd() % world.cli_cnt + 1);
+}
+
+static void new_relayout(uint64_t k)
+{
+	core_relayout((k & 1) ? 1920 : 1600);
+}
+
+static void new_walk(uint64_t k)
+{
+	sink = core_walk();
+}
+
+static void new_fetch(uint64_t k)
+{
+	sink = core_fetch(rnd() % world.cli_cnt + 1);
+}
+
+static void new_init(uint64_t n)
+{
+	memset(&world, 0, sizeof(world));
+	world.seed = 1;
+	world.cli_cnt = n;
+	core_world_init(n);
+}
+
+static const struct {
+	const char *name;
+	void (*init)(uint64_t n);
+	void (*fini)(void);
+	void (*func)(uint64_t k);
+} models[] = {
+	{ "old m_update",	old_init,	world_free,	 old_relayout },
+	{ "core m_update",	new_init,	core_world_free, new_relayout },
+	{ "old walk",		old_init,	world_free,	 old_walk },
+	{ "core walk",		new_init,	core_world_free, new_walk },
+	{ "old c_fetch",	old_init,	world_free,	 old_fetch },
+	{ "core c_fetch",	new_init,	core_world_free, new_fetch },
+};
+
+static void bench_model(unsigned int i, uint64_t n)
+{
+	uint64_t iters, k, t0, dt, cold = 0, miss = 0, miss0 = 0;
+
+	models[i].init(n);
+
+	iters = 1;
+	for (;;) {
+		t0 = now_ns();
+		for (k = 0; k < iters; k++)
+			models[i].func(k);
+		dt = now_ns() - t0;
+
+		if (dt >= BENCH_MIN_NS)
+			break;
+		iters *= 2;
+	}
+
+	for (k = 0; k < COLD_RUNS; k++) {
+		cold_evict();
+		if (perf_fd >= 0) {
+			ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+			miss0 = perf_read();
+		}
+		t0 = now_ns();
+		models[i].func(k);
+		cold += now_ns() - t0;
+		if (perf_fd >= 0) {
+			miss += perf_read() - miss0;
+			ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+
+	printf("%-28s %8lu %12.1f %12.1f ", models[i].name, n,
+		(double)dt / iters, (double)cold / COLD_RUNS);
+	if (perf_fd >= 0)
+		printf("%12.1f\n", (double)miss / COLD_RUNS);
+	else
+		printf("%12s\n", "-");
+
+	models[i].fini();
+}
+
+static struct {
+	struct evq *q;
+	uint64_t gap_max;	/* longest the reader went without reading */
+	uint32_t is_done;
+} burst;
+
+/* stands in for XNextEvent(): one event every BURST_GAP_NS, catching up
+ * at once whenever it fell behind, like a socket with data queued */
+static void *burst_reader(void *arg)
+{
+	struct timespec ts;
+	XEvent ev;
+	uint64_t i, t, t_prev, next;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = MotionNotify;
+	t_prev = next = now_ns();
+
+	for (i = 0; i < BURST_EVENTS; i++) {
+		if (now_ns() < next) {
+			ts.tv_sec = next / 1000000000ULL;
+			ts.tv_nsec = next % 1000000000ULL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+					NULL);
+		}
+		t = now_ns();
+		if (t - t_prev > burst.gap_max)
+			burst.gap_max = t - t_prev;
+		t_prev = t;
+		ev.xany.serial = t;
+		evq_push(burst.q, &ev);
+		next += BURST_GAP_NS;
+	}
+
+	__atomic_store_n(&burst.is_done, 1, __ATOMIC_SEQ_CST);
+	evq_wake(burst.q);
+	return NULL;
+}
+
+static void bench_burst(uint64_t n)
+{
+	struct pollfd pfd;
+	pthread_t thread;
+	XEvent ev;
+	uint64_t k = 0, t, t0, lat_max = 0, lay_max = 0, batch_gap = 0;
+	uint64_t t_batch = 0;
+
+	world_init(n, 1);
+	memset(&burst, 0, sizeof(burst));
+	if (!(burst.q = evq_init()))
+		return;
+	pfd.fd = burst.q->wake[0];
+	pfd.events = POLLIN;
+
+	pthread_create(&thread, NULL, burst_reader, NULL);
+	for (;;) {
+		if (evq_pop(burst.q, &ev)) {
+			t = now_ns();
+			if (t_batch && t - t_batch > batch_gap)
+				batch_gap = t - t_batch;
+			t_batch = t;
+			do {
+				t = now_ns() - ev.xany.serial;
+				if (t > lat_max)
+					lat_max = t;
+			} while (evq_pop(burst.q, &ev));
+
+			t0 = now_ns();
+			old_relayout(k++);
+			if (now_ns() - t0 > lay_max)
+				lay_max = now_ns() - t0;
+			continue;
+		}
+
+		if (__atomic_load_n(&burst.is_done, __ATOMIC_SEQ_CST) &&
+		    burst.q->tail == burst.q->head)
+			break;
+		if (evq_sleep(burst.q)) {
+			poll(&pfd, 1, 10);
+			evq_woken(burst.q);
+		}
+	}
+	pthread_join(thread, NULL);
+
+	printf("%-20s %8lu %10.1f %10.1f %10lu %10u %10.1f %10.1f\n",
+		"m_update per batch", n,
+		lay_max / 1000.0, batch_gap / 1000.0,
+		(unsigned long)burst.q->stalls, burst.q->depth_max,
+		burst.gap_max / 1000.0, lat_max / 1000.0);
+
+	evq_free(burst.q);
+	world_free();
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t n, n_max = 100000;
+	unsigned int i;
+	bool is_ok = true;
+
+	if (argc > 1)
+		n_max = strtoull(argv[1], NULL, 10);
+
+	printf("%-28s %8s %12s %10s %10s\n",
+		"op", "n", "ns/op", "allocs/op", "xreq/op");
+
+	for (i = 0; i < sizeof(ops) / sizeof(*ops); i++) {
+		for (n = 10; n <= n_max; n *= 10)
+			bench_op(i, n);
+		printf("\n");
+	}
+
+	printf("%-28s %8s %10s %10s %10s %10s\n", "size-hinted clients", "n",
+		"xreq/op", "notify/op", "cfgreq/op", "rounds/op");
+	for (n = 10; n <= n_max && n <= 10000; n *= 10)
+		bench_configure(n);
+
+	printf("\n%-20s %8s %10s %10s %10s %10s %10s\n", "event", "n",
+		"req avg", "req max", "rt avg", "rt max", "rt budget");
+	for (n = 10; n <= n_max && n <= 10000; n *= 10)
+		is_ok = bench_events(n) && is_ok;
+	is_ok = bench_class() && is_ok;
+
+	printf("%-20s %8s %10s %10s %10s\n", "layout", "n",
+		"full req", "step req", "step ns");
+	for (n = 10; n <= n_max; n *= 10)
+		bench_scroll(n);
+	for (n = 10; n <= n_max; n *= 10)
+		bench_view(n);
+	printf("\n");
+
+	printf("%-20s %8s %10s %10s %10s %10s\n", "snapshot", "n",
+		"bytes", "same ns", "moved ns", "published");
+	for (n = 10; n <= n_max; n *= 10)
+		bench_snap(n);
+	printf("\n");
+
+	perf_open();
+	printf("struct cli: old %lu bytes, core %lu hot bytes\n",
+		(unsigned long)sizeof(struct cli),
+		(unsigned long)core_cli_size());
+	printf("%-28s %8s %12s %12s %12s\n", "model", "n",
+		"warm ns/op", "cold ns/op", "misses/op");
+	for (i = 0; i < sizeof(models) / sizeof(*models); i++) {
+		for (n = 10; n <= n_max; n *= 10)
+			bench_model(i, n);
+		if (i & 1)
+			printf("\n");
+	}
+
+	printf("\n%-20s %8s %10s %10s %10s %10s %10s %10s\n",
+		"burst", "n", "layout us", "inline us", "stalls", "depth",
+		"reader us", "latency us");
+	for (n = 100; n <= n_max; n *= 10)
+		bench_burst(n);
+
+	free(cold_buf);
+	if (!is_ok)
+		fprintf(stderr, "pico-bench: round-trip budget exceeded or "
+			"WM_CLASS misparsed\n");
+	return is_ok ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+/*
+ * The index-based model of the new ../pico.c, built as its own
+ * translation unit so its names do not clash with the ones of this
+ * directory's pico.c.  bench.c drives it through the core_* hooks below
+ * and times it against the pointer-based model.
+ */
+#include "../pico.c"
+
+static uint32_t core_mon;
+static uint64_t core_flushed;
+
+void core_world_init(uint64_t n)
+{
+	uint64_t i;
+
+	core_init();
+	core_mon = m_init(1, 0, 0, 1920, 1080);
+	for (i = 0; i < n; i++)
+		c_init(MON(core_mon)->tab_sel, i + 1, LAYOUT_TILE);
+	m_update(core_mon);
+}
+
+void core_world_free(void)
+{
+	core_fini();
+}
+
+/* what a backend would do after a layout: send and clear dirty clients */
+static void core_flush(uint32_t head)
+{
+	uint32_t c = head;
+
+	if (c)
+		do {
+			if (CLI(c)->is_dirty) {
+				CLI(c)->is_dirty = false;
+				core_flushed++;
+			}
+		} while ((c = CLI(c)->link[0]) != head);
+}
+
+void core_relayout(int w)
+{
+	MON(core_mon)->geo[0] = w;
+	m_update(core_mon);
+	core_flush(TAB(MON(core_mon)->tab_sel)->clis[LAYOUT_TILE]);
+}
+
+uint64_t core_walk(void)
+{
+	const struct tab *tp = TAB(MON(core_mon)->tab_sel);
+	const struct cli *clis = runtime.clis.hot;
+	uint64_t sum = 0;
+	uint32_t c, head;
+	int l;
+
+	for (l = 0; l < LAYOUT_LAST; l++)
+		if ((c = head = tp->clis[l]))
+			do
+				sum += clis[c].pos[0] + clis[c].geo[0];
+			while ((c = clis[c].link[0]) != head);
+	return sum;
+}
+
+uint32_t core_fetch(uint32_t win)
+{
+	return c_fetch(win);
+}
+
+size_t core_cli_size(void)
+{
+	return sizeof(struct cli);
+}
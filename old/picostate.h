@@ -0,0 +1,244 @@
+/*
+ * picostate.h: the state pico publishes for bars and scripts, and the
+ * reader for it.
+ *
+ * pico maps $XDG_RUNTIME_DIR/pico-$DISPLAY.state and, at the end of
+ * every event batch that changed something, rewrites it in
+ * place: seq goes odd, the snapshot is copied in, seq goes even again.
+ * A reader copies the snapshot out and retries if seq was odd or moved
+ * meanwhile.  It never sends pico a message and never blocks it; to wait
+ * for a change, poll ps_seq().  Without $XDG_RUNTIME_DIR nothing is
+ * published: a fixed name in /tmp is anyone's to plant first.
+ *
+ * The snapshot is a struct ps_head followed by mon_cnt struct ps_mon,
+ * tab_cnt struct ps_tab and cli_cnt struct ps_cli, size bytes in all.
+ * Tabs are grouped by monitor and clients by tab, scratchpad clients
+ * last.  Indices refer into those arrays, PS_NONE is none.
+ *
+ *	struct ps_reader r;
+ *	static char buf[PS_SIZE];
+ *	const struct ps_head *h = (const struct ps_head *)buf;
+ *
+ *	if (!ps_open(&r, NULL) && !ps_read(&r, buf, sizeof(buf)) &&
+ *	    h->cli_sel != PS_NONE)
+ *		puts(ps_clis(h)[h->cli_sel].title);
+ *	ps_close(&r);
+ *
+ * Under -std=c99, readers define _POSIX_C_SOURCE 200809L first.  A reader
+ * that gets ESTALE reopens: a new pico publishes to a new file.
+ */
+#ifndef PICOSTATE_H
+#define PICOSTATE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PS_MAGIC	0x31736370u	/* "pcs1" */
+#define PS_SIZE		(1 << 20)	/* the mapping, snapshots never exceed it */
+#define PS_NONE		0xffffffffu
+#define PS_TRIES	1000		/* reads before giving up on a writer */
+
+enum {
+	PS_LAYOUT_TILE,
+	PS_LAYOUT_SCROLL
+};
+
+/* ps_cli.flags */
+#define PS_CLI_FLOAT	(1u << 0)
+#define PS_CLI_HIDE	(1u << 1)	/* unmapped by pico */
+#define PS_CLI_URGENT	(1u << 2)
+#define PS_CLI_SCRATCH	(1u << 3)
+
+/* ps_head.flags */
+#define PS_TRUNCATED	(1u << 0)	/* clients left out, over PS_SIZE */
+
+struct ps_head {
+	uint32_t magic;		/* 0 once pico has quit */
+	uint32_t seq;		/* odd while pico writes */
+	uint32_t size;		/* of the snapshot, this head included */
+	uint32_t flags;
+	uint32_t mon_cnt;
+	uint32_t tab_cnt;
+	uint32_t cli_cnt;
+	uint32_t mon_sel;
+	uint32_t tab_sel;
+	uint32_t cli_sel;
+};
+
+struct ps_mon {
+	int32_t x, y, w, h;
+	uint32_t tab_sel;
+	uint32_t tab_cnt;
+};
+
+struct ps_tab {
+	char name[32];
+	uint32_t mon;
+	uint32_t cli_sel;
+	uint32_t cli_cnt;
+	uint32_t view;		/* tags shown */
+	uint8_t layout;		/* PS_LAYOUT_* */
+	uint8_t is_sel;
+	uint8_t pad[6];
+};
+
+struct ps_cli {
+	uint64_t win;
+	uint32_t tab;		/* PS_NONE on the scratchpad */
+	uint32_t tags;
+	int32_t x, y;
+	uint32_t w, h;
+	int32_t pid;		/* 0 if unknown */
+	uint32_t flags;		/* PS_CLI_* */
+	char class[64];
+	char title[256];
+};
+
+struct ps_reader {
+	const struct ps_head *map;
+};
+
+static inline const struct ps_mon *ps_mons(const struct ps_head *h)
+{
+	return (const struct ps_mon *)(h + 1);
+}
+
+static inline const struct ps_tab *ps_tabs(const struct ps_head *h)
+{
+	return (const struct ps_tab *)(ps_mons(h) + h->mon_cnt);
+}
+
+static inline const struct ps_cli *ps_clis(const struct ps_head *h)
+{
+	return (const struct ps_cli *)(ps_tabs(h) + h->tab_cnt);
+}
+
+/* where pico on display (NULL: $DISPLAY) publishes, -1 if nowhere */
+static inline int ps_path(char *buf, size_t len, const char *display)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	char *p;
+	size_t n;
+
+	if (!dir || !*dir) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (!display && !(display = getenv("DISPLAY")))
+		display = ":0";
+	snprintf(buf, len, "%s/pico-", dir);
+	n = strlen(buf);
+	snprintf(buf + n, len - n, "%s.state", display);
+	for (p = buf + n; *p; p++)
+		if (*p == '/')
+			*p = '_';
+	return 0;
+}
+
+/* a regular file of ours, not a link or someone else's plant */
+static inline int ps_check(int fd, off_t size)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+	if (!S_ISREG(st.st_mode) || st.st_uid != getuid() ||
+	    st.st_size < size) {
+		errno = EPERM;
+		return -1;
+	}
+	return 0;
+}
+
+static inline int ps_open(struct ps_reader *r, const char *display)
+{
+	char path[512];
+	void *map;
+	int fd;
+
+	if (ps_path(path, sizeof(path), display) < 0 ||
+	    (fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) < 0)
+		return -1;
+	/* a short file would SIGBUS the reader past its end */
+	map = ps_check(fd, PS_SIZE) < 0 ? MAP_FAILED :
+		mmap(NULL, PS_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	r->map = map;
+	return 0;
+}
+
+static inline void ps_close(struct ps_reader *r)
+{
+	if (r->map)
+		munmap((void *)r->map, PS_SIZE);
+	r->map = NULL;
+}
+
+/* changes whenever a new snapshot is published */
+static inline uint32_t ps_seq(const struct ps_reader *r)
+{
+	return __atomic_load_n(&r->map->seq, __ATOMIC_ACQUIRE) & ~1u;
+}
+
+/*
+ * Copies a consistent snapshot into buf.  Fails with ESTALE once pico
+ * has quit, EAGAIN if it never finished a write in PS_TRIES attempts
+ * and ENOSPC if len cannot hold the snapshot.
+ */
+static inline int ps_read(const struct ps_reader *r, void *buf, size_t len)
+{
+	const struct ps_head *h = buf;
+	uint32_t seq, size;
+	int i;
+
+	if (len < sizeof(*h)) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	for (i = 0; i < PS_TRIES; i++) {
+		if ((seq = __atomic_load_n(&r->map->seq,
+		    __ATOMIC_ACQUIRE)) & 1) {
+			sched_yield();
+			continue;
+		}
+
+		size = __atomic_load_n(&r->map->size, __ATOMIC_RELAXED);
+		if (size < sizeof(*h) || size > PS_SIZE) {
+			size = sizeof(*h);
+		} else if (size > len) {
+			if (__atomic_load_n(&r->map->seq, __ATOMIC_ACQUIRE) !=
+			    seq)
+				continue;
+			errno = ENOSPC;
+			return -1;
+		}
+		memcpy(buf, r->map, size);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&r->map->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+
+		if (h->magic != PS_MAGIC) {
+			errno = ESTALE;
+			return -1;
+		}
+		return 0;
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+#endif
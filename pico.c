@@ -1,12 +1,10 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define VERSION "alpha 0.0.1"
 
-#define MOUSE_MODE_NONE   0;
-#define MOUSE_MODE_MOVE   1;
-#define MOUSE_MODE_RESIZE 2;
-
 #define XK_SHIFT	ShiftMask
 #define XK_LOCK		LockMask
 #define XK_CONTROL	ControlMask
@@ -16,6 +14,20 @@
 #define XK_SUPER	Mod4Mask
 #define XK_LOGO		Mod5Mask
 
+#define BAR_HEIGHT	16
+
+enum mouse_mode {
+	MOUSE_MODE_NONE,
+	MOUSE_MODE_MOVE,
+	MOUSE_MODE_RESIZE
+};
+
+enum layout {
+	LAYOUT_TILE,
+	LAYOUT_FLOAT,
+	LAYOUT_LAST
+};
+
 struct arg;
 struct cli;
 struct tab;
@@ -26,41 +38,845 @@ struct arg {
 	const int i;
 };
 
+/*
+ * The model knows nothing about X.  Objects live in per-type pools and
+ * point at each other with 32-bit indices; slot 0 is the nil record, so
+ * a zeroed link means "none".  Hot records are 32 bytes, two to a cache
+ * line, and hold only what layout and list walks read.  Names, hints and
+ * the saved float geometry sit in a parallel cold array.
+ */
+#define NIL	0
+
 struct cli {
-        struct cli *link[2];       // {next, prev}
-        int pos[2];                // {til_x, til_y, flt_x, flt_y}
-        unsigned int geo[4];       // {til_w, til_h, flt_w, flt_h}
-        bool is_selected  : 1;
-        bool is_focused   : 1;
-        bool is_hidden    : 1;
-        uint8_t layout    : 2;     // 0 = float, 1 = tile;
+	uint32_t link[2];	/* {next, prev}, circular */
+	uint32_t win;		/* backend handle */
+	uint32_t tab;		/* NIL while on the doc list */
+	uint32_t hash;		/* next in the win lookup chain */
+	int16_t pos[2];		/* {x, y} */
+	uint16_t geo[2];	/* {w, h} */
+	bool is_sel		: 1;
+	bool is_foc		: 1;
+	bool is_hide		: 1;
+	bool is_dirty		: 1;	/* backend has not seen the change */
+	bool is_hinted		: 1;	/* size hints in struct cli_meta */
+	bool is_unmap_by_wm	: 1;
+	uint8_t layout		: 2;	/* enum layout */
+};
+
+struct cli_meta {
+	char name[256];
+	char class[64];
+	char instance[64];
+	int16_t flt_pos[2];	/* float geometry kept while tiled */
+	uint16_t flt_geo[2];
+	int basew, baseh;
+	int incw, inch;
+	int minw, minh;
+	int maxw, maxh;
+	float mina, maxa;
+	int32_t pid;
+	uint64_t map_seq;
+	uint64_t stack_seq;
 };
 
 struct tab {
-        char name[32];
-        struct tab *link[2];    // {next, prev}
-        uint64_t cli_cnt[2];    // {tils_cnt, flt_cnt}
-        struct cli *tils;
-        struct cli *flts;
-        struct mon *mon;
-        bool is_selected  : 1;
-        bool is_focused   : 1;
-        bool is_hidden    : 1;
+	uint32_t link[2];		/* {next, prev} on its monitor */
+	uint32_t mon;
+	uint32_t cli_sel;
+	uint32_t clis[LAYOUT_LAST];	/* {tils, flts}, the first til is master */
+	uint32_t cli_cnt[LAYOUT_LAST];
+};
+
+struct tab_meta {
+	char name[32];
 };
 
 struct mon {
-        uint64_t tab_cnt;
-        struct tab *tabs;
-        int pos[2];             // {x, y}
-        unsigned int geo[2];    // {w, h}
-        bool is_selected  : 1;
-        bool is_focused   : 1;
+	uint32_t link[2];
+	uint32_t tabs;
+	uint32_t tab_sel;
+	uint32_t tab_cnt;
+	uint32_t id;		/* backend output */
+	int16_t pos[2];		/* {x, y} */
+	uint16_t geo[2];	/* {w, h} */
+};
+
+/* fails to compile if a hot record outgrows half a cache line */
+typedef char cli_size_check[sizeof(struct cli) == 32 ? 1 : -1];
+typedef char tab_size_check[sizeof(struct tab) == 32 ? 1 : -1];
+typedef char mon_size_check[sizeof(struct mon) == 32 ? 1 : -1];
+
+struct pool {
+	void *hot;
+	void *cold;
+	size_t hot_sz;
+	size_t cold_sz;
+	uint32_t cnt;		/* slots handed out, nil included */
+	uint32_t cap;
+	uint32_t free;		/* released slots, chained through link[0] */
 };
 
-struct {
-        uint64_t mon_cnt;
-        struct mon *mons;
+static struct {
+	struct pool clis;
+	struct pool tabs;
+	struct pool mons;
+	uint32_t mon_cnt;
+	uint32_t mons_head;
+	uint32_t mon_sel;
+	uint32_t tab_sel;
+	uint32_t cli_sel;
+	uint32_t cli_foc;
+	uint32_t doc;		/* clients without a tab */
+	uint32_t *win_hash;	/* 1 << win_bits chain heads */
+	uint32_t win_bits;
+	uint32_t cli_live;
+	int bar_h;
 } runtime;
 
+static bool core_init(void);
+static void core_fini(void);
+static uint32_t c_fetch(uint32_t win);
+static void c_attach_t(uint32_t c, uint32_t t);
+static void c_detach_t(uint32_t c);
+static void c_attach_d(uint32_t c);
+static void c_detach_d(uint32_t c);
+static uint32_t c_init(uint32_t t, uint32_t win, enum layout layout);
+static void c_free(uint32_t c);
+static void c_place(uint32_t c, int x, int y, int w, int h);
+static void c_hide(uint32_t c);
+static void c_show(uint32_t c);
+static void c_sel(uint32_t c);
+static void c_tile(uint32_t c);
+static void c_float(uint32_t c);
+static void c_moveto_t(uint32_t c, uint32_t t);
+static void c_moveto_m(uint32_t c, uint32_t m);
+static void t_attach_m(uint32_t t, uint32_t m);
+static void t_detach_m(uint32_t t);
+static uint32_t t_init(uint32_t m);
+static void t_move(uint32_t t, int d);
+static void t_unsel(uint32_t t);
+static void t_sel(uint32_t t);
+static void t_moveto_m(uint32_t t, uint32_t m);
+static bool t_remove(uint32_t t);
+static void m_sel(uint32_t m);
+static uint32_t m_init(uint32_t id, int x, int y, int w, int h);
+static void m_destroy(uint32_t m);
+static void m_update(uint32_t m);
+
+#define CLI(i)		((struct cli *)runtime.clis.hot + (i))
+#define CLI_META(i)	((struct cli_meta *)runtime.clis.cold + (i))
+#define TAB(i)		((struct tab *)runtime.tabs.hot + (i))
+#define TAB_META(i)	((struct tab_meta *)runtime.tabs.cold + (i))
+#define MON(i)		((struct mon *)runtime.mons.hot + (i))
+
+/* every record starts with its link pair */
+#define LINK(p, i)	((uint32_t *)((char *)(p)->hot + (size_t)(i) * (p)->hot_sz))
+
+static bool pool_init(struct pool *p, size_t hot_sz, size_t cold_sz)
+{
+	p->hot_sz = hot_sz;
+	p->cold_sz = cold_sz;
+	p->cap = 64;
+	p->cnt = 1;
+	p->free = NIL;
+
+	p->hot = calloc(p->cap, hot_sz);
+	p->cold = cold_sz ? calloc(p->cap, cold_sz) : NULL;
+	return p->hot && (!cold_sz || p->cold);
+}
+
+static void pool_fini(struct pool *p)
+{
+	free(p->hot);
+	free(p->cold);
+	memset(p, 0, sizeof(*p));
+}
+
+/* returns a zeroed slot; any record pointer held across this is stale */
+static uint32_t pool_get(struct pool *p)
+{
+	void *hot, *cold;
+	uint32_t i, cap;
+
+	if (p->free) {
+		i = p->free;
+		p->free = LINK(p, i)[0];
+	} else {
+		if (p->cnt == p->cap) {
+			cap = p->cap * 2;
+			if (!(hot = realloc(p->hot, cap * p->hot_sz)))
+				return NIL;
+			p->hot = hot;
+			if (p->cold_sz) {
+				if (!(cold = realloc(p->cold, cap * p->cold_sz)))
+					return NIL;
+				p->cold = cold;
+			}
+			p->cap = cap;
+		}
+		i = p->cnt++;
+	}
+
+	memset((char *)p->hot + (size_t)i * p->hot_sz, 0, p->hot_sz);
+	if (p->cold_sz)
+		memset((char *)p->cold + (size_t)i * p->cold_sz, 0,
+		       p->cold_sz);
+	return i;
+}
+
+static void pool_put(struct pool *p, uint32_t i)
+{
+	LINK(p, i)[0] = p->free;
+	LINK(p, i)[1] = NIL;
+	p->free = i;
+}
+
+/* links i in front of at; at must be on a non-empty ring */
+static void ring_ins(struct pool *p, uint32_t i, uint32_t at)
+{
+	uint32_t *l = LINK(p, i);
+	uint32_t *a = LINK(p, at);
+
+	l[0] = at;
+	l[1] = a[1];
+	LINK(p, a[1])[0] = i;
+	a[1] = i;
+}
+
+static void ring_add(struct pool *p, uint32_t *head, uint32_t i, bool is_tail)
+{
+	uint32_t *l = LINK(p, i);
+
+	if (!*head) {
+		l[0] = l[1] = i;
+		*head = i;
+		return;
+	}
+
+	ring_ins(p, i, *head);
+	if (!is_tail)
+		*head = i;
+}
+
+static void ring_del(struct pool *p, uint32_t *head, uint32_t i)
+{
+	uint32_t *l = LINK(p, i);
+
+	if (l[0] == i) {
+		*head = NIL;
+	} else {
+		LINK(p, l[1])[0] = l[0];
+		LINK(p, l[0])[1] = l[1];
+		if (*head == i)
+			*head = l[0];
+	}
+
+	l[0] = l[1] = NIL;
+}
+
+/* Fibonacci hashing: the top bits of the product are the well mixed ones */
+static uint32_t win_slot(uint32_t win)
+{
+	return (win * 2654435761u) >> (32 - runtime.win_bits);
+}
+
+static void win_rehash(uint32_t bits)
+{
+	uint32_t *hash, i, s;
+
+	if (!(hash = calloc((size_t)1 << bits, sizeof(*hash))))
+		return;
+
+	free(runtime.win_hash);
+	runtime.win_hash = hash;
+	runtime.win_bits = bits;
+
+	for (i = 1; i < runtime.clis.cnt; i++) {
+		if (!CLI(i)->win)
+			continue;
+		s = win_slot(CLI(i)->win);
+		CLI(i)->hash = hash[s];
+		hash[s] = i;
+	}
+}
+
+static void win_add(uint32_t c)
+{
+	uint32_t s = win_slot(CLI(c)->win);
+
+	CLI(c)->hash = runtime.win_hash[s];
+	runtime.win_hash[s] = c;
+}
+
+static void win_del(uint32_t c)
+{
+	uint32_t *i = &runtime.win_hash[win_slot(CLI(c)->win)];
+
+	for (; *i; i = &CLI(*i)->hash) {
+		if (*i == c) {
+			*i = CLI(c)->hash;
+			break;
+		}
+	}
+	CLI(c)->hash = NIL;
+}
+
+static bool core_init(void)
+{
+	memset(&runtime, 0, sizeof(runtime));
+
+	if (!pool_init(&runtime.clis, sizeof(struct cli),
+		       sizeof(struct cli_meta)) ||
+	    !pool_init(&runtime.tabs, sizeof(struct tab),
+		       sizeof(struct tab_meta)) ||
+	    !pool_init(&runtime.mons, sizeof(struct mon), 0))
+		return false;
+
+	win_rehash(6);
+	return runtime.win_hash != NULL;
+}
+
+static void core_fini(void)
+{
+	pool_fini(&runtime.clis);
+	pool_fini(&runtime.tabs);
+	pool_fini(&runtime.mons);
+	free(runtime.win_hash);
+	memset(&runtime, 0, sizeof(runtime));
+}
+
+static uint32_t c_fetch(uint32_t win)
+{
+	uint32_t i;
+
+	for (i = runtime.win_hash[win_slot(win)]; i; i = CLI(i)->hash)
+		if (CLI(i)->win == win)
+			return i;
+	return NIL;
+}
+
+/* tiled clients go to the tail so the master stays put */
+static void c_attach_t(uint32_t c, uint32_t t)
+{
+	struct cli *cp = CLI(c);
+	struct tab *tp = TAB(t);
+
+	cp->tab = t;
+	ring_add(&runtime.clis, &tp->clis[cp->layout], c,
+		 cp->layout == LAYOUT_TILE);
+	tp->cli_cnt[cp->layout]++;
+}
+
+static void c_detach_t(uint32_t c)
+{
+	struct cli *cp = CLI(c);
+	struct tab *tp;
+
+	if (!cp->tab)
+		return;
+
+	tp = TAB(cp->tab);
+	ring_del(&runtime.clis, &tp->clis[cp->layout], c);
+	tp->cli_cnt[cp->layout]--;
+
+	if (tp->cli_sel == c)
+		tp->cli_sel = NIL;
+	if (runtime.cli_sel == c)
+		runtime.cli_sel = NIL;
+	if (runtime.cli_foc == c)
+		runtime.cli_foc = NIL;
+	cp->tab = NIL;
+}
+
+static void c_attach_d(uint32_t c)
+{
+	CLI(c)->tab = NIL;
+	ring_add(&runtime.clis, &runtime.doc, c, false);
+}
+
+static void c_detach_d(uint32_t c)
+{
+	ring_del(&runtime.clis, &runtime.doc, c);
+	if (runtime.cli_foc == c)
+		runtime.cli_foc = NIL;
+}
+
+/* a new client on t, or on the doc list when t is NIL */
+static uint32_t c_init(uint32_t t, uint32_t win, enum layout layout)
+{
+	struct cli_meta *cm;
+	struct cli *cp;
+	struct mon *mp;
+	uint32_t c;
+
+	if (runtime.cli_live >= 1u << runtime.win_bits)
+		win_rehash(runtime.win_bits + 1);
+
+	if (!(c = pool_get(&runtime.clis)))
+		return NIL;
+
+	cp = CLI(c);
+	cm = CLI_META(c);
+	cp->win = win;
+	cp->layout = layout;
+	cp->is_dirty = true;
+	if (t && (mp = MON(TAB(t)->mon))) {
+		cm->flt_geo[0] = cp->geo[0] = mp->geo[0] / 2;
+		cm->flt_geo[1] = cp->geo[1] = mp->geo[1] / 2;
+		cm->flt_pos[0] = cp->pos[0] = mp->pos[0];
+		cm->flt_pos[1] = cp->pos[1] = mp->pos[1];
+	}
+
+	win_add(c);
+	runtime.cli_live++;
+
+	if (t)
+		c_attach_t(c, t);
+	else
+		c_attach_d(c);
+	return c;
+}
+
+static void c_free(uint32_t c)
+{
+	if (CLI(c)->tab)
+		c_detach_t(c);
+	else
+		c_detach_d(c);
+
+	win_del(c);
+	CLI(c)->win = 0;
+	runtime.cli_live--;
+	pool_put(&runtime.clis, c);
+}
+
+/* clamps w/h to the client's WM_NORMAL_HINTS, read from the cold side */
+static void c_hints(uint32_t c, int *w, int *h)
+{
+	const struct cli_meta *p = CLI_META(c);
+	bool is_base_min = p->basew == p->minw && p->baseh == p->minh;
+
+	if (!is_base_min) {
+		*w -= p->basew;
+		*h -= p->baseh;
+	}
+
+	if (p->mina > 0 && p->maxa > 0 && *w > 0 && *h > 0) {
+		if (p->maxa < (float)*w / *h)
+			*w = *h * p->maxa + 0.5;
+		else if (p->mina < (float)*h / *w)
+			*h = *w * p->mina + 0.5;
+	}
+
+	if (is_base_min) {
+		*w -= p->basew;
+		*h -= p->baseh;
+	}
+
+	if (p->incw > 0)
+		*w -= *w % p->incw;
+	if (p->inch > 0)
+		*h -= *h % p->inch;
+
+	*w += p->basew;
+	*h += p->baseh;
+
+	if (*w < p->minw)
+		*w = p->minw;
+	if (*h < p->minh)
+		*h = p->minh;
+	if (p->maxw > 0 && *w > p->maxw)
+		*w = p->maxw;
+	if (p->maxh > 0 && *h > p->maxh)
+		*h = p->maxh;
+	if (*w < 1)
+		*w = 1;
+	if (*h < 1)
+		*h = 1;
+}
+
+static void c_place(uint32_t c, int x, int y, int w, int h)
+{
+	struct cli *cp = CLI(c);
+
+	if (cp->is_hinted)
+		c_hints(c, &w, &h);
+
+	if (cp->pos[0] == x && cp->pos[1] == y && cp->geo[0] == w &&
+	    cp->geo[1] == h)
+		return;
+
+	cp->pos[0] = x;
+	cp->pos[1] = y;
+	cp->geo[0] = w;
+	cp->geo[1] = h;
+	cp->is_dirty = true;
+
+	if (cp->layout == LAYOUT_FLOAT) {
+		memcpy(CLI_META(c)->flt_pos, cp->pos, sizeof(cp->pos));
+		memcpy(CLI_META(c)->flt_geo, cp->geo, sizeof(cp->geo));
+	}
+}
+
+static void c_hide(uint32_t c)
+{
+	struct cli *cp = CLI(c);
+
+	if (cp->is_hide)
+		return;
+	cp->is_hide = true;
+	cp->is_dirty = true;
+}
+
+static void c_show(uint32_t c)
+{
+	struct cli *cp = CLI(c);
+
+	if (!cp->is_hide)
+		return;
+	cp->is_hide = false;
+	cp->is_dirty = true;
+}
+
+static void c_sel(uint32_t c)
+{
+	struct cli *cp = CLI(c);
+
+	if (!c || runtime.cli_sel == c)
+		return;
+
+	if (runtime.cli_sel) {
+		CLI(runtime.cli_sel)->is_sel = false;
+		CLI(runtime.cli_sel)->is_foc = false;
+	}
+
+	cp->is_sel = true;
+	cp->is_foc = true;
+	runtime.cli_sel = c;
+	runtime.cli_foc = c;
+	if (cp->tab)
+		TAB(cp->tab)->cli_sel = c;
+}
+
+static void c_relayout(uint32_t c, enum layout layout)
+{
+	struct cli *cp = CLI(c);
+	uint32_t t = cp->tab;
+
+	if (cp->layout == layout)
+		return;
+
+	if (t)
+		c_detach_t(c);
+	cp->layout = layout;
+	if (t) {
+		c_attach_t(c, t);
+		m_update(TAB(t)->mon);
+	}
+}
+
+static void c_tile(uint32_t c)
+{
+	c_relayout(c, LAYOUT_TILE);
+}
+
+static void c_float(uint32_t c)
+{
+	const struct cli_meta *cm = CLI_META(c);
+	struct cli *cp = CLI(c);
+
+	if (cp->layout == LAYOUT_FLOAT)
+		return;
+
+	cp->pos[0] = cm->flt_pos[0];
+	cp->pos[1] = cm->flt_pos[1];
+	cp->geo[0] = cm->flt_geo[0];
+	cp->geo[1] = cm->flt_geo[1];
+	cp->is_dirty = true;
+	c_relayout(c, LAYOUT_FLOAT);
+}
+
+static void c_moveto_t(uint32_t c, uint32_t t)
+{
+	uint32_t t_old = CLI(c)->tab;
+
+	if (!t || t_old == t)
+		return;
+
+	c_detach_t(c);
+	c_attach_t(c, t);
+
+	if (t_old)
+		m_update(TAB(t_old)->mon);
+	t_sel(t);
+	m_update(TAB(t)->mon);
+}
+
+static void c_moveto_m(uint32_t c, uint32_t m)
+{
+	uint32_t t = CLI(c)->tab;
+
+	if (!m || (t && TAB(t)->mon == m) || !MON(m)->tab_sel)
+		return;
+	c_moveto_t(c, MON(m)->tab_sel);
+}
+
+static void t_attach_m(uint32_t t, uint32_t m)
+{
+	TAB(t)->mon = m;
+	ring_add(&runtime.tabs, &MON(m)->tabs, t, false);
+	MON(m)->tab_cnt++;
+}
+
+static void t_detach_m(uint32_t t)
+{
+	struct tab *tp = TAB(t);
+	struct mon *mp;
+
+	if (!tp->mon)
+		return;
+
+	mp = MON(tp->mon);
+	ring_del(&runtime.tabs, &mp->tabs, t);
+	mp->tab_cnt--;
+
+	if (mp->tab_sel == t)
+		mp->tab_sel = NIL;
+	if (runtime.tab_sel == t)
+		runtime.tab_sel = NIL;
+	tp->mon = NIL;
+}
+
+static uint32_t t_init(uint32_t m)
+{
+	uint32_t t;
+
+	if (!m || !(t = pool_get(&runtime.tabs)))
+		return NIL;
+
+	t_attach_m(t, m);
+	return t;
+}
+
+/* swaps t with its neighbour, d < 0 towards the head */
+static void t_move(uint32_t t, int d)
+{
+	struct pool *p = &runtime.tabs;
+	uint32_t *head, at;
+
+	if (!TAB(t)->mon || MON(TAB(t)->mon)->tab_cnt < 2)
+		return;
+
+	head = &MON(TAB(t)->mon)->tabs;
+	if (d < 0) {
+		if (t == *head)
+			return;
+		at = LINK(p, t)[1];
+		ring_del(p, head, t);
+		ring_ins(p, t, at);
+		if (*head == at)
+			*head = t;
+	} else if (d > 0) {
+		at = LINK(p, t)[0];
+		if (at == *head)
+			return;
+		ring_del(p, head, t);
+		ring_ins(p, t, LINK(p, at)[0]);
+	}
+}
+
+static void t_unsel(uint32_t t)
+{
+	struct tab *tp = TAB(t);
+	uint32_t c;
+	int l;
+
+	for (l = 0; l < LAYOUT_LAST; l++)
+		if ((c = tp->clis[l]))
+			do
+				c_hide(c);
+			while ((c = CLI(c)->link[0]) != tp->clis[l]);
+
+	if (tp->mon && MON(tp->mon)->tab_sel == t)
+		MON(tp->mon)->tab_sel = NIL;
+	if (runtime.tab_sel == t)
+		runtime.tab_sel = NIL;
+}
+
+static void t_sel(uint32_t t)
+{
+	struct tab *tp = TAB(t);
+
+	if (!t || runtime.tab_sel == t)
+		return;
+
+	if (runtime.tab_sel)
+		t_unsel(runtime.tab_sel);
+
+	runtime.tab_sel = t;
+	if (tp->mon) {
+		MON(tp->mon)->tab_sel = t;
+		m_sel(tp->mon);
+	}
+
+	if (tp->cli_sel)
+		c_sel(tp->cli_sel);
+	else if (tp->clis[LAYOUT_TILE])
+		c_sel(tp->clis[LAYOUT_TILE]);
+	else if (tp->clis[LAYOUT_FLOAT])
+		c_sel(tp->clis[LAYOUT_FLOAT]);
+
+	m_update(tp->mon);
+}
+
+static void t_moveto_m(uint32_t t, uint32_t m)
+{
+	uint32_t m_old = TAB(t)->mon;
+
+	if (!m || m_old == m)
+		return;
+
+	t_detach_m(t);
+	t_attach_m(t, m);
+
+	m_update(m_old);
+	t_sel(t);
+	m_update(m);
+}
+
+/* hands t's clients to a neighbour; the last tab of a monitor stays */
+static bool t_remove(uint32_t t)
+{
+	struct tab *tp = TAB(t);
+	uint32_t m = tp->mon, t_fallback, c;
+	int l;
+
+	if (!m || MON(m)->tab_cnt < 2)
+		return false;
+
+	t_fallback = tp->link[0];
+	for (l = 0; l < LAYOUT_LAST; l++) {
+		while ((c = TAB(t)->clis[l])) {
+			c_detach_t(c);
+			c_attach_t(c, t_fallback);
+		}
+	}
+
+	t_detach_m(t);
+	pool_put(&runtime.tabs, t);
+	t_sel(t_fallback);
+	return true;
+}
+
+static void m_sel(uint32_t m)
+{
+	if (!m || runtime.mon_sel == m)
+		return;
+
+	if (runtime.mon_sel && MON(runtime.mon_sel)->tab_sel)
+		t_unsel(MON(runtime.mon_sel)->tab_sel);
+
+	runtime.mon_sel = m;
+	if (MON(m)->tab_sel)
+		t_sel(MON(m)->tab_sel);
+}
+
+static uint32_t m_init(uint32_t id, int x, int y, int w, int h)
+{
+	struct mon *mp;
+	uint32_t m, t;
+
+	if (!(m = pool_get(&runtime.mons)))
+		return NIL;
+
+	mp = MON(m);
+	mp->id = id;
+	mp->pos[0] = x;
+	mp->pos[1] = y;
+	mp->geo[0] = w;
+	mp->geo[1] = h;
+	ring_add(&runtime.mons, &runtime.mons_head, m, true);
+	runtime.mon_cnt++;
+
+	if (!(t = t_init(m))) {
+		ring_del(&runtime.mons, &runtime.mons_head, m);
+		runtime.mon_cnt--;
+		pool_put(&runtime.mons, m);
+		return NIL;
+	}
+
+	MON(m)->tab_sel = t;
+	if (runtime.mon_cnt == 1)
+		m_sel(m);
+	return m;
+}
+
+static void m_destroy(uint32_t m)
+{
+	uint32_t m_fallback = MON(m)->link[0], t;
+
+	if (m_fallback == m)
+		return;
+
+	while ((t = MON(m)->tabs))
+		t_moveto_m(t, m_fallback);
+
+	ring_del(&runtime.mons, &runtime.mons_head, m);
+	runtime.mon_cnt--;
+	if (runtime.mon_sel == m)
+		runtime.mon_sel = NIL;
+	pool_put(&runtime.mons, m);
+	m_sel(m_fallback);
+}
+
+/*
+ * Master/stack layout of the selected tab.  Only the hot records are
+ * read unless a client carries size hints; changed clients are left
+ * marked is_dirty for the backend.
+ */
+static void m_update(uint32_t m)
+{
+	const struct mon *mp;
+	const struct tab *tp;
+	uint32_t c, head;
+	int x, y, w, h;
+	int master_w, stack_w, stack_h;
+	uint32_t i, n_til;
+
+	if (!m || !(mp = MON(m))->tab_sel)
+		return;
+
+	tp = TAB(mp->tab_sel);
+	if ((c = head = tp->clis[LAYOUT_FLOAT]))
+		do
+			c_show(c);
+		while ((c = CLI(c)->link[0]) != head);
+
+	if (!(n_til = tp->cli_cnt[LAYOUT_TILE]))
+		return;
+
+	head = tp->clis[LAYOUT_TILE];
+	x = mp->pos[0];
+	y = mp->pos[1] + runtime.bar_h;
+	w = mp->geo[0];
+	h = mp->geo[1] - runtime.bar_h;
+
+	if (n_til == 1) {
+		c_place(head, x, y, w, h);
+		c_show(head);
+		return;
+	}
+
+	master_w = w * 55 / 100;
+	stack_w = w - master_w;
+	stack_h = h / (n_til - 1);
+
+	c_place(head, x, y, master_w, h);
+	c_show(head);
 
-int xsetup;
+	for (i = 0, c = CLI(head)->link[0]; c != head;
+	     i++, c = CLI(c)->link[0]) {
+		c_place(c, x + master_w, y + i * stack_h, stack_w, stack_h);
+		c_show(c);
+	}
+}
@@ -0,0 +1,791 @@
+/*
+ * pico-wl: headless Wayland backend for the pico core (../pico.c).
+ *
+ * Clients talk xdg-shell and hand over wl_shm buffers; the core lays
+ * them out exactly as it does X windows.  The output is a pixman image in
+ * plain memory: buffers are wrapped in place instead of copied, and only
+ * the region damaged since the last frame is recomposited.  SIGUSR1
+ * writes the current frame to $XDG_RUNTIME_DIR/pico-wl.ppm.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+#include <pixman.h>
+#include "xdg-shell-protocol.h"
+
+#include "../pico.c"
+
+#define FRAME_MS	16
+#define OUTPUT_W	1920
+#define OUTPUT_H	1080
+#define BG_COLOR	0x222222
+
+struct surface {
+	struct wl_resource *res;
+	struct wl_resource *buffer;		/* attached, not yet committed */
+	struct wl_resource *buffer_cur;		/* committed, read in place */
+	struct wl_listener buffer_destroy;
+	pixman_region32_t damage;		/* pending, surface coords */
+	struct wl_list frames;			/* pending frame callbacks */
+	struct wl_list frames_cur;
+	struct wl_resource *xdg_surface;
+	struct view *view;
+	bool is_attach;
+};
+
+/* an xdg_toplevel and the core client it is */
+struct view {
+	struct wl_list link;
+	struct surface *surf;
+	struct wl_resource *xdg_surface;
+	struct wl_resource *toplevel;
+	uint32_t cli;
+	int x, y, w, h;				/* as last composited */
+	bool is_shown;
+};
+
+static struct {
+	struct wl_display *dpy;
+	struct wl_event_loop *loop;
+	struct wl_event_source *frame_timer;
+	pixman_image_t *fb;
+	uint32_t *fb_data;
+	int w, h;
+	pixman_region32_t damage;		/* output coords */
+	struct wl_list views;
+	struct view **by_cli;			/* indexed like the core pool */
+	uint32_t by_cli_cap;
+	uint32_t win_seq;
+	uint32_t mon;
+	uint64_t frames;
+	uint64_t pixels;
+} server;
+
+static void resource_destroy(struct wl_client *client,
+			     struct wl_resource *res)
+{
+	wl_resource_destroy(res);
+}
+
+static void damage_rect(int x, int y, int w, int h)
+{
+	pixman_region32_union_rect(&server.damage, &server.damage, x, y,
+				   w, h);
+}
+
+static struct view *view_of(uint32_t cli)
+{
+	return cli < server.by_cli_cap ? server.by_cli[cli] : NULL;
+}
+
+static bool view_bind(struct view *v, uint32_t cli)
+{
+	struct view **by;
+	uint32_t cap;
+
+	if (cli >= server.by_cli_cap) {
+		cap = runtime.clis.cap;
+		if (!(by = realloc(server.by_cli, cap * sizeof(*by))))
+			return false;
+		memset(by + server.by_cli_cap, 0,
+		       (cap - server.by_cli_cap) * sizeof(*by));
+		server.by_cli = by;
+		server.by_cli_cap = cap;
+	}
+
+	server.by_cli[cli] = v;
+	v->cli = cli;
+	return true;
+}
+
+/*
+ * Runs the core layout and turns whatever it left is_dirty into
+ * configure events and output damage.
+ */
+static void layout_apply(void)
+{
+	struct wl_array states;
+	struct view *v;
+	struct cli *cp;
+	uint32_t *st;
+	bool is_shown;
+
+	m_update(server.mon);
+
+	wl_list_for_each(v, &server.views, link) {
+		cp = CLI(v->cli);
+		if (!cp->is_dirty)
+			continue;
+		cp->is_dirty = false;
+
+		is_shown = !cp->is_hide && v->surf->buffer_cur;
+		if (v->is_shown)
+			damage_rect(v->x, v->y, v->w, v->h);
+
+		if (cp->geo[0] != v->w || cp->geo[1] != v->h) {
+			wl_array_init(&states);
+			if (cp->is_sel && (st = wl_array_add(&states,
+							     sizeof(*st))))
+				*st = XDG_TOPLEVEL_STATE_ACTIVATED;
+			xdg_toplevel_send_configure(v->toplevel, cp->geo[0],
+						    cp->geo[1], &states);
+			xdg_surface_send_configure(v->xdg_surface,
+				wl_display_next_serial(server.dpy));
+			wl_array_release(&states);
+		}
+
+		v->x = cp->pos[0];
+		v->y = cp->pos[1];
+		v->w = cp->geo[0];
+		v->h = cp->geo[1];
+		v->is_shown = is_shown;
+		if (is_shown)
+			damage_rect(v->x, v->y, v->w, v->h);
+	}
+}
+
+static void view_composite(struct view *v)
+{
+	struct wl_shm_buffer *shm;
+	pixman_image_t *img;
+	pixman_format_code_t fmt;
+	int w, h;
+
+	if (!v || !v->is_shown ||
+	    !(shm = wl_shm_buffer_get(v->surf->buffer_cur)))
+		return;
+
+	fmt = wl_shm_buffer_get_format(shm) == WL_SHM_FORMAT_ARGB8888 ?
+		PIXMAN_a8r8g8b8 : PIXMAN_x8r8g8b8;
+	w = wl_shm_buffer_get_width(shm);
+	h = wl_shm_buffer_get_height(shm);
+
+	wl_shm_buffer_begin_access(shm);
+	img = pixman_image_create_bits_no_clear(fmt, w, h,
+		wl_shm_buffer_get_data(shm), wl_shm_buffer_get_stride(shm));
+	if (img) {
+		pixman_image_composite32(fmt == PIXMAN_a8r8g8b8 ?
+			PIXMAN_OP_OVER : PIXMAN_OP_SRC, img, NULL, server.fb,
+			0, 0, 0, 0, v->x, v->y,
+			w < v->w ? w : v->w, h < v->h ? h : v->h);
+		pixman_image_unref(img);
+	}
+	wl_shm_buffer_end_access(shm);
+}
+
+/* tiled clients first, floating ones on top, as in the X backend */
+static void output_repaint(void)
+{
+	const pixman_color_t bg = {
+		(BG_COLOR >> 16 & 0xff) * 0x101,
+		(BG_COLOR >> 8 & 0xff) * 0x101,
+		(BG_COLOR & 0xff) * 0x101,
+		0xffff
+	};
+	const struct tab *tp;
+	pixman_box32_t *box;
+	uint32_t c, head;
+	int i, n, l;
+
+	if (!pixman_region32_not_empty(&server.damage))
+		return;
+
+	pixman_region32_intersect_rect(&server.damage, &server.damage, 0, 0,
+				       server.w, server.h);
+	box = pixman_region32_rectangles(&server.damage, &n);
+	pixman_image_fill_boxes(PIXMAN_OP_SRC, server.fb, &bg, n, box);
+	for (i = 0; i < n; i++)
+		server.pixels += (uint64_t)(box[i].x2 - box[i].x1) *
+			(box[i].y2 - box[i].y1);
+
+	pixman_image_set_clip_region32(server.fb, &server.damage);
+	tp = TAB(MON(server.mon)->tab_sel);
+	for (l = 0; l < LAYOUT_LAST; l++)
+		if ((c = head = tp->clis[l]))
+			do
+				view_composite(view_of(c));
+			while ((c = CLI(c)->link[0]) != head);
+	pixman_image_set_clip_region32(server.fb, NULL);
+
+	pixman_region32_clear(&server.damage);
+	server.frames++;
+}
+
+static void frame_done(uint32_t ms)
+{
+	struct wl_resource *cb, *tmp;
+	struct view *v;
+
+	wl_list_for_each(v, &server.views, link) {
+		wl_resource_for_each_safe(cb, tmp, &v->surf->frames_cur) {
+			wl_callback_send_done(cb, ms);
+			wl_resource_destroy(cb);
+		}
+	}
+}
+
+static int frame_tick(void *data)
+{
+	struct timespec ts;
+
+	output_repaint();
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	frame_done(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+	wl_event_source_timer_update(server.frame_timer, FRAME_MS);
+	return 0;
+}
+
+static int snapshot(int sig, void *data)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	char path[512];
+	uint32_t p;
+	FILE *f;
+	int fd, i;
+
+	/* not /tmp: a fixed name there is anyone's to plant a link at */
+	if (!dir || !*dir) {
+		fprintf(stderr, "pico-wl: no XDG_RUNTIME_DIR, no snapshot\n");
+		return 0;
+	}
+	snprintf(path, sizeof(path), "%s/pico-wl.ppm", dir);
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW |
+	    O_CLOEXEC, 0600)) < 0)
+		return 0;
+	if (!(f = fdopen(fd, "w"))) {
+		close(fd);
+		return 0;
+	}
+
+	fprintf(f, "P6\n%d %d\n255\n", server.w, server.h);
+	for (i = 0; i < server.w * server.h; i++) {
+		p = server.fb_data[i];
+		fputc(p >> 16 & 0xff, f);
+		fputc(p >> 8 & 0xff, f);
+		fputc(p & 0xff, f);
+	}
+	fclose(f);
+
+	fprintf(stderr, "pico-wl: %s, %lu frames, %lu pixels composited\n",
+		path, (unsigned long)server.frames,
+		(unsigned long)server.pixels);
+	return 0;
+}
+
+static void surface_buffer_destroy(struct wl_listener *l, void *data)
+{
+	struct surface *s = wl_container_of(l, s, buffer_destroy);
+
+	if (s->buffer_cur == data)
+		s->buffer_cur = NULL;
+	if (s->buffer == data)
+		s->buffer = NULL;
+	wl_list_remove(&l->link);
+	wl_list_init(&l->link);
+}
+
+static void surface_attach(struct wl_client *client, struct wl_resource *res,
+			   struct wl_resource *buffer, int32_t x, int32_t y)
+{
+	struct surface *s = wl_resource_get_user_data(res);
+
+	s->buffer = buffer;
+	s->is_attach = true;
+}
+
+static void surface_damage(struct wl_client *client, struct wl_resource *res,
+			   int32_t x, int32_t y, int32_t w, int32_t h)
+{
+	struct surface *s = wl_resource_get_user_data(res);
+
+	pixman_region32_union_rect(&s->damage, &s->damage, x, y, w, h);
+}
+
+static void surface_frame(struct wl_client *client, struct wl_resource *res,
+			  uint32_t id)
+{
+	struct surface *s = wl_resource_get_user_data(res);
+	struct wl_resource *cb;
+
+	if (!(cb = wl_resource_create(client, &wl_callback_interface, 1, id))) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(cb, NULL, NULL, NULL);
+	wl_list_insert(s->frames.prev, wl_resource_get_link(cb));
+}
+
+static void surface_region(struct wl_client *client, struct wl_resource *res,
+			   struct wl_resource *region)
+{
+}
+
+static void surface_commit(struct wl_client *client, struct wl_resource *res)
+{
+	struct surface *s = wl_resource_get_user_data(res);
+	struct view *v = s->view;
+	bool was_shown = v && v->is_shown;
+
+	if (s->is_attach) {
+		if (s->buffer_cur && s->buffer_cur != s->buffer)
+			wl_buffer_send_release(s->buffer_cur);
+		wl_list_remove(&s->buffer_destroy.link);
+		wl_list_init(&s->buffer_destroy.link);
+		if ((s->buffer_cur = s->buffer))
+			wl_resource_add_destroy_listener(s->buffer,
+							 &s->buffer_destroy);
+		s->buffer = NULL;
+		s->is_attach = false;
+	}
+
+	wl_list_insert_list(s->frames_cur.prev, &s->frames);
+	wl_list_init(&s->frames);
+
+	if (v && v->cli) {
+		v->is_shown = s->buffer_cur && !CLI(v->cli)->is_hide;
+		if (v->is_shown && !was_shown) {
+			damage_rect(v->x, v->y, v->w, v->h);
+		} else if (!v->is_shown && was_shown) {
+			damage_rect(v->x, v->y, v->w, v->h);
+		} else if (v->is_shown) {
+			pixman_region32_translate(&s->damage, v->x, v->y);
+			pixman_region32_intersect_rect(&s->damage, &s->damage,
+						       v->x, v->y, v->w, v->h);
+			pixman_region32_union(&server.damage, &server.damage,
+					      &s->damage);
+		}
+	}
+	pixman_region32_clear(&s->damage);
+}
+
+static void surface_set_transform(struct wl_client *client,
+				  struct wl_resource *res, int32_t t)
+{
+}
+
+static void surface_set_scale(struct wl_client *client,
+			      struct wl_resource *res, int32_t scale)
+{
+}
+
+static const struct wl_surface_interface surface_impl = {
+	.destroy		= resource_destroy,
+	.attach			= surface_attach,
+	.damage			= surface_damage,
+	.frame			= surface_frame,
+	.set_opaque_region	= surface_region,
+	.set_input_region	= surface_region,
+	.commit			= surface_commit,
+	.set_buffer_transform	= surface_set_transform,
+	.set_buffer_scale	= surface_set_scale,
+	/* buffer scale is always 1, so buffer and surface damage agree */
+	.damage_buffer		= surface_damage,
+};
+
+static void view_destroy(struct view *v);
+
+static void surface_free(struct wl_resource *res)
+{
+	struct surface *s = wl_resource_get_user_data(res);
+	struct wl_resource *cb, *tmp;
+
+	/* a disconnecting client's wl_surface goes before its role objects */
+	if (s->view)
+		view_destroy(s->view);
+	if (s->xdg_surface)
+		wl_resource_set_user_data(s->xdg_surface, NULL);
+	wl_resource_for_each_safe(cb, tmp, &s->frames)
+		wl_resource_destroy(cb);
+	wl_resource_for_each_safe(cb, tmp, &s->frames_cur)
+		wl_resource_destroy(cb);
+	wl_list_remove(&s->buffer_destroy.link);
+	pixman_region32_fini(&s->damage);
+	free(s);
+}
+
+static void compositor_create_surface(struct wl_client *client,
+				      struct wl_resource *res, uint32_t id)
+{
+	struct surface *s;
+
+	if (!(s = calloc(1, sizeof(*s))) ||
+	    !(s->res = wl_resource_create(client, &wl_surface_interface,
+					  wl_resource_get_version(res), id))) {
+		free(s);
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	pixman_region32_init(&s->damage);
+	wl_list_init(&s->frames);
+	wl_list_init(&s->frames_cur);
+	s->buffer_destroy.notify = surface_buffer_destroy;
+	wl_list_init(&s->buffer_destroy.link);
+	wl_resource_set_implementation(s->res, &surface_impl, s, surface_free);
+}
+
+static void region_add(struct wl_client *client, struct wl_resource *res,
+		       int32_t x, int32_t y, int32_t w, int32_t h)
+{
+}
+
+/* opaque and input regions do not matter to a headless output */
+static const struct wl_region_interface region_impl = {
+	.destroy	= resource_destroy,
+	.add		= region_add,
+	.subtract	= region_add,
+};
+
+static void compositor_create_region(struct wl_client *client,
+				     struct wl_resource *res, uint32_t id)
+{
+	struct wl_resource *r;
+
+	if (!(r = wl_resource_create(client, &wl_region_interface, 1, id))) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(r, &region_impl, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_impl = {
+	.create_surface	= compositor_create_surface,
+	.create_region	= compositor_create_region,
+};
+
+static void compositor_bind(struct wl_client *client, void *data,
+			    uint32_t version, uint32_t id)
+{
+	struct wl_resource *r;
+
+	if (!(r = wl_resource_create(client, &wl_compositor_interface,
+				     version, id))) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(r, &compositor_impl, NULL, NULL);
+}
+
+static const struct wl_output_interface output_impl = {
+	.release	= resource_destroy,
+};
+
+static void output_bind(struct wl_client *client, void *data,
+			uint32_t version, uint32_t id)
+{
+	struct wl_resource *r;
+
+	if (!(r = wl_resource_create(client, &wl_output_interface, version,
+				     id))) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(r, &output_impl, NULL, NULL);
+
+	wl_output_send_geometry(r, 0, 0, 0, 0, WL_OUTPUT_SUBPIXEL_UNKNOWN,
+				"pico", "headless",
+				WL_OUTPUT_TRANSFORM_NORMAL);
+	wl_output_send_mode(r, WL_OUTPUT_MODE_CURRENT, server.w, server.h,
+			    1000000 / FRAME_MS);
+	if (version >= WL_OUTPUT_DONE_SINCE_VERSION)
+		wl_output_send_done(r);
+}
+
+static void view_destroy(struct view *v)
+{
+	if (v->is_shown)
+		damage_rect(v->x, v->y, v->w, v->h);
+	if (v->cli) {
+		server.by_cli[v->cli] = NULL;
+		c_free(v->cli);
+	}
+	if (v->surf)
+		v->surf->view = NULL;
+	wl_resource_set_user_data(v->toplevel, NULL);
+	wl_list_remove(&v->link);
+	free(v);
+	layout_apply();
+}
+
+/*
+ * xdg_toplevel requests go through a dispatcher keyed by name, so the
+ * many the core has no use for do not each need a stub.
+ */
+static int toplevel_dispatch(const void *impl, void *target, uint32_t opcode,
+			     const struct wl_message *msg,
+			     union wl_argument *args)
+{
+	struct wl_resource *res = target;
+	struct view *v = wl_resource_get_user_data(res);
+	struct cli_meta *cm;
+
+	if (!strcmp(msg->name, "destroy")) {
+		wl_resource_destroy(res);
+		return 0;
+	}
+	if (!v || !v->cli)
+		return 0;
+
+	cm = CLI_META(v->cli);
+	if (!strcmp(msg->name, "set_title")) {
+		snprintf(cm->name, sizeof(cm->name), "%s",
+			 args[0].s ? args[0].s : "");
+	} else if (!strcmp(msg->name, "set_app_id")) {
+		snprintf(cm->class, sizeof(cm->class), "%s",
+			 args[0].s ? args[0].s : "");
+	} else if (!strcmp(msg->name, "set_min_size")) {
+		cm->minw = args[0].i;
+		cm->minh = args[1].i;
+		CLI(v->cli)->is_hinted = true;
+	} else if (!strcmp(msg->name, "set_max_size")) {
+		cm->maxw = args[0].i;
+		cm->maxh = args[1].i;
+		CLI(v->cli)->is_hinted = true;
+	}
+	return 0;
+}
+
+static void toplevel_free(struct wl_resource *res)
+{
+	struct view *v = wl_resource_get_user_data(res);
+
+	if (v)
+		view_destroy(v);
+}
+
+static void xdg_surface_get_toplevel(struct wl_client *client,
+				     struct wl_resource *res, uint32_t id)
+{
+	struct surface *s = wl_resource_get_user_data(res);
+	struct view *v;
+	uint32_t c;
+
+	if (!s) {
+		wl_resource_post_error(res, XDG_SURFACE_ERROR_NOT_CONSTRUCTED,
+				       "its wl_surface is gone");
+		return;
+	}
+	if (s->view) {
+		wl_resource_post_error(res, XDG_SURFACE_ERROR_ALREADY_CONSTRUCTED,
+				       "xdg_surface already has a toplevel");
+		return;
+	}
+
+	if (!(v = calloc(1, sizeof(*v))) ||
+	    !(v->toplevel = wl_resource_create(client, &xdg_toplevel_interface,
+		wl_resource_get_version(res), id))) {
+		free(v);
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	v->surf = s;
+	v->xdg_surface = res;
+	s->view = v;
+	wl_list_insert(server.views.prev, &v->link);
+	wl_resource_set_dispatcher(v->toplevel, toplevel_dispatch, NULL, v,
+				   toplevel_free);
+
+	if (!(c = c_init(MON(server.mon)->tab_sel, ++server.win_seq,
+			 LAYOUT_TILE)) || !view_bind(v, c)) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	c_sel(c);
+	layout_apply();
+}
+
+static void xdg_surface_get_popup(struct wl_client *client,
+				  struct wl_resource *res, uint32_t id,
+				  struct wl_resource *parent,
+				  struct wl_resource *positioner)
+{
+	wl_resource_post_error(res, XDG_WM_BASE_ERROR_INVALID_POPUP_PARENT,
+			       "pico-wl has no popups yet");
+}
+
+static void xdg_surface_set_geometry(struct wl_client *client,
+				     struct wl_resource *res, int32_t x,
+				     int32_t y, int32_t w, int32_t h)
+{
+}
+
+static void xdg_surface_ack(struct wl_client *client,
+			    struct wl_resource *res, uint32_t serial)
+{
+}
+
+/* the toplevel cannot outlive its xdg_surface: it has nothing to configure */
+static void xdg_surface_free(struct wl_resource *res)
+{
+	struct surface *s = wl_resource_get_user_data(res);
+
+	if (!s)
+		return;
+	if (s->view)
+		view_destroy(s->view);
+	s->xdg_surface = NULL;
+}
+
+static const struct xdg_surface_interface xdg_surface_impl = {
+	.destroy		= resource_destroy,
+	.get_toplevel		= xdg_surface_get_toplevel,
+	.get_popup		= xdg_surface_get_popup,
+	.set_window_geometry	= xdg_surface_set_geometry,
+	.ack_configure		= xdg_surface_ack,
+};
+
+static int positioner_dispatch(const void *impl, void *target,
+			       uint32_t opcode, const struct wl_message *msg,
+			       union wl_argument *args)
+{
+	if (!strcmp(msg->name, "destroy"))
+		wl_resource_destroy(target);
+	return 0;
+}
+
+static void wm_base_create_positioner(struct wl_client *client,
+				      struct wl_resource *res, uint32_t id)
+{
+	struct wl_resource *r;
+
+	if (!(r = wl_resource_create(client, &xdg_positioner_interface,
+				     wl_resource_get_version(res), id))) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_dispatcher(r, positioner_dispatch, NULL, NULL, NULL);
+}
+
+static void wm_base_get_xdg_surface(struct wl_client *client,
+				    struct wl_resource *res, uint32_t id,
+				    struct wl_resource *surface)
+{
+	struct surface *s = wl_resource_get_user_data(surface);
+	struct wl_resource *r;
+
+	if (s->xdg_surface) {
+		wl_resource_post_error(res, XDG_WM_BASE_ERROR_ROLE,
+				       "wl_surface already has an xdg_surface");
+		return;
+	}
+
+	if (!(r = wl_resource_create(client, &xdg_surface_interface,
+				     wl_resource_get_version(res), id))) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	s->xdg_surface = r;
+	wl_resource_set_implementation(r, &xdg_surface_impl, s,
+				       xdg_surface_free);
+}
+
+static void wm_base_pong(struct wl_client *client, struct wl_resource *res,
+			 uint32_t serial)
+{
+}
+
+static const struct xdg_wm_base_interface wm_base_impl = {
+	.destroy		= resource_destroy,
+	.create_positioner	= wm_base_create_positioner,
+	.get_xdg_surface	= wm_base_get_xdg_surface,
+	.pong			= wm_base_pong,
+};
+
+static void wm_base_bind(struct wl_client *client, void *data,
+			 uint32_t version, uint32_t id)
+{
+	struct wl_resource *r;
+
+	if (!(r = wl_resource_create(client, &xdg_wm_base_interface, version,
+				     id))) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(r, &wm_base_impl, NULL, NULL);
+}
+
+static void setup(int w, int h)
+{
+	const char *socket;
+
+	if (!core_init()) {
+		fprintf(stderr, "pico-wl: cannot allocate the core\n");
+		exit(1);
+	}
+
+	server.w = w;
+	server.h = h;
+	server.mon = m_init(1, 0, 0, w, h);
+	wl_list_init(&server.views);
+	pixman_region32_init_rect(&server.damage, 0, 0, w, h);
+
+	if (!(server.fb_data = calloc((size_t)w * h, 4)) ||
+	    !(server.fb = pixman_image_create_bits(PIXMAN_x8r8g8b8, w, h,
+						   server.fb_data, w * 4))) {
+		fprintf(stderr, "pico-wl: cannot allocate a %dx%d output\n",
+			w, h);
+		exit(1);
+	}
+
+	if (!(server.dpy = wl_display_create())) {
+		fprintf(stderr, "pico-wl: cannot create display\n");
+		exit(1);
+	}
+	server.loop = wl_display_get_event_loop(server.dpy);
+
+	wl_display_init_shm(server.dpy);
+	wl_global_create(server.dpy, &wl_compositor_interface, 4, NULL,
+			 compositor_bind);
+	wl_global_create(server.dpy, &wl_output_interface, 3, NULL,
+			 output_bind);
+	wl_global_create(server.dpy, &xdg_wm_base_interface, 1, NULL,
+			 wm_base_bind);
+
+	if (!(socket = wl_display_add_socket_auto(server.dpy))) {
+		fprintf(stderr, "pico-wl: cannot add a socket\n");
+		exit(1);
+	}
+
+	server.frame_timer = wl_event_loop_add_timer(server.loop, frame_tick,
+						     NULL);
+	wl_event_source_timer_update(server.frame_timer, FRAME_MS);
+	wl_event_loop_add_signal(server.loop, SIGUSR1, snapshot, NULL);
+
+	setenv("WAYLAND_DISPLAY", socket, 1);
+	fprintf(stderr, "pico-wl: running on WAYLAND_DISPLAY=%s (%dx%d)\n",
+		socket, w, h);
+}
+
+static void quit(void)
+{
+	wl_display_destroy_clients(server.dpy);
+	wl_display_destroy(server.dpy);
+	pixman_image_unref(server.fb);
+	pixman_region32_fini(&server.damage);
+	free(server.fb_data);
+	free(server.by_cli);
+	core_fini();
+}
+
+int main(int argc, char *argv[])
+{
+	int w = OUTPUT_W, h = OUTPUT_H;
+
+	if (argc > 2 && !strcmp(argv[1], "-s") &&
+	    sscanf(argv[2], "%dx%d", &w, &h) != 2) {
+		fprintf(stderr, "usage: pico-wl [-s WIDTHxHEIGHT]\n");
+		return 1;
+	}
+
+	setup(w, h);
+	wl_display_run(server.dpy);
+	quit();
+	return 0;
+}
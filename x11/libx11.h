@@ -1,22 +1,150 @@
-#include <stdint.h>
-#include <stdbool.h>
+/*
+ * Xlib backend: the window requests of the WM logic in old/pico.c go out
+ * through Xlib, the way they always have.  Every backend in this
+ * directory defines the same static inline be_* functions and
+ * old/pico.c includes exactly one of them, so a call costs what the
+ * underlying library call costs.
+ *
+ * Properties are read through the separate XCB connection so the reads
+ * of several windows can be pipelined; Xlib has no asynchronous
+ * GetProperty.
+ */
 #include <stdlib.h>
-#include <stdio.h>
-#include <unistd.h>
-#include <sys/wait.h>
 #include <X11/Xlib.h>
-#include <X11/keysym.h>
-#include <X11/Xutil.h>
-#include <stdarg.h>
-#include <time.h>
-#include <string.h>
-#include <X11/Xproto.h>
-
-struct xcli {
-        char name[256];
-        Window win;
-        Monitor *mon;
-        unsigned int minw, minh;
-        float mina, maxa;
-        bool is_neverfocus;
-};
\ No newline at end of file
+#include <xcb/xcb.h>
+
+#define BACKEND_NAME	"xlib"
+
+static uint64_t be_xc_req;	/* requests on the property connection */
+
+static inline void be_configure(Display *dpy, Window win, unsigned int mask,
+				XWindowChanges *wc)
+{
+	XConfigureWindow(dpy, win, mask, wc);
+}
+
+static inline void be_move(Display *dpy, Window win, int x, int y)
+{
+	XMoveWindow(dpy, win, x, y);
+}
+
+static inline void be_resize(Display *dpy, Window win, unsigned int w,
+			     unsigned int h)
+{
+	XResizeWindow(dpy, win, w, h);
+}
+
+static inline void be_moveresize(Display *dpy, Window win, int x, int y,
+				 unsigned int w, unsigned int h)
+{
+	XMoveResizeWindow(dpy, win, x, y, w, h);
+}
+
+static inline void be_map(Display *dpy, Window win)
+{
+	XMapWindow(dpy, win);
+}
+
+static inline void be_unmap(Display *dpy, Window win)
+{
+	XUnmapWindow(dpy, win);
+}
+
+static inline void be_raise(Display *dpy, Window win)
+{
+	XRaiseWindow(dpy, win);
+}
+
+static inline void be_focus(Display *dpy, Window win)
+{
+	XSetInputFocus(dpy, win, RevertToPointerRoot, CurrentTime);
+}
+
+static inline void be_send(Display *dpy, Window win, long mask, XEvent *ev)
+{
+	XSendEvent(dpy, win, False, mask, ev);
+}
+
+static inline xcb_get_property_cookie_t be_prop_get(xcb_connection_t *xc,
+		Window win, Atom prop, Atom type, uint32_t len)
+{
+	be_xc_req++;
+	return xcb_get_property(xc, 0, win, prop, type, 0, len);
+}
+
+/* errors are taken and freed here: on xc nothing would ever read them */
+static inline xcb_get_property_reply_t *be_prop_reply(xcb_connection_t *xc,
+		xcb_get_property_cookie_t pc)
+{
+	xcb_generic_error_t *err = NULL;
+	xcb_get_property_reply_t *r = xcb_get_property_reply(xc, pc, &err);
+
+	free(err);
+	return r;
+}
+
+static inline xcb_get_window_attributes_cookie_t be_attr_get(
+		xcb_connection_t *xc, Window win)
+{
+	be_xc_req++;
+	return xcb_get_window_attributes(xc, win);
+}
+
+static inline xcb_get_window_attributes_reply_t *be_attr_reply(
+		xcb_connection_t *xc, xcb_get_window_attributes_cookie_t ac)
+{
+	xcb_generic_error_t *err = NULL;
+	xcb_get_window_attributes_reply_t *r =
+		xcb_get_window_attributes_reply(xc, ac, &err);
+
+	free(err);
+	return r;
+}
+
+static inline xcb_get_geometry_cookie_t be_geom_get(xcb_connection_t *xc,
+		Window win)
+{
+	be_xc_req++;
+	return xcb_get_geometry(xc, win);
+}
+
+static inline xcb_get_geometry_reply_t *be_geom_reply(xcb_connection_t *xc,
+		xcb_get_geometry_cookie_t gc)
+{
+	xcb_generic_error_t *err = NULL;
+	xcb_get_geometry_reply_t *r = xcb_get_geometry_reply(xc, gc, &err);
+
+	free(err);
+	return r;
+}
+
+static inline void be_select(Display *dpy, Window win, long mask)
+{
+	XSelectInput(dpy, win, mask);
+}
+
+static inline void be_sync(Display *dpy)
+{
+	XSync(dpy, False);
+}
+
+/* requests issued so far, on both connections */
+static inline uint64_t be_seq(Display *dpy)
+{
+	return XNextRequest(dpy) - 1 + be_xc_req;
+}
+
+static inline int be_fd(Display *dpy)
+{
+	return ConnectionNumber(dpy);
+}
+
+static inline int be_pending(Display *dpy)
+{
+	return XPending(dpy);
+}
+
+static inline void be_next(Display *dpy, XEvent *ev)
+{
+	XNextEvent(dpy, ev);
+}
@@ -0,0 +1,176 @@
+/*
+ * Null backend: no display server at all.  Every request is counted in
+ * be_null and dropped, properties read back empty, every window looks
+ * like a plain 640x480 one and the event source never has anything.
+ * pico-bench builds against it to time the layout code and the event
+ * handlers on their own.
+ *
+ * Define BE_NULL_ON_CONFIGURE(win, w, h) before including pico.c to see
+ * the sizes a real client would have been configured to.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include <xcb/xcb.h>
+
+#define BACKEND_NAME	"null"
+
+#ifndef BE_NULL_ON_CONFIGURE
+#define BE_NULL_ON_CONFIGURE(win, w, h)
+#endif
+
+static struct {
+	uint64_t req;		/* every request below */
+	uint64_t configure;
+	uint64_t map;
+	uint64_t unmap;
+	uint64_t raise;
+	uint64_t focus;
+	uint64_t send;
+	uint64_t prop;
+	uint64_t sync;
+} be_null;
+
+static inline void be_configure(Display *dpy, Window win, unsigned int mask,
+				XWindowChanges *wc)
+{
+	be_null.req++;
+	be_null.configure++;
+	if (mask & (CWWidth | CWHeight))
+		BE_NULL_ON_CONFIGURE(win, wc->width, wc->height);
+}
+
+static inline void be_move(Display *dpy, Window win, int x, int y)
+{
+	be_null.req++;
+	be_null.configure++;
+}
+
+static inline void be_resize(Display *dpy, Window win, unsigned int w,
+			     unsigned int h)
+{
+	be_null.req++;
+	be_null.configure++;
+}
+
+static inline void be_moveresize(Display *dpy, Window win, int x, int y,
+				 unsigned int w, unsigned int h)
+{
+	be_null.req++;
+	be_null.configure++;
+	BE_NULL_ON_CONFIGURE(win, w, h);
+}
+
+static inline void be_map(Display *dpy, Window win)
+{
+	be_null.req++;
+	be_null.map++;
+}
+
+static inline void be_unmap(Display *dpy, Window win)
+{
+	be_null.req++;
+	be_null.unmap++;
+}
+
+static inline void be_raise(Display *dpy, Window win)
+{
+	be_null.req++;
+	be_null.raise++;
+}
+
+static inline void be_focus(Display *dpy, Window win)
+{
+	be_null.req++;
+	be_null.focus++;
+}
+
+static inline void be_send(Display *dpy, Window win, long mask, XEvent *ev)
+{
+	be_null.req++;
+	be_null.send++;
+}
+
+static inline xcb_get_property_cookie_t be_prop_get(xcb_connection_t *xc,
+		Window win, Atom prop, Atom type, uint32_t len)
+{
+	xcb_get_property_cookie_t pc = { 0 };
+
+	be_null.req++;
+	be_null.prop++;
+	return pc;
+}
+
+static inline xcb_get_property_reply_t *be_prop_reply(xcb_connection_t *xc,
+		xcb_get_property_cookie_t pc)
+{
+	return NULL;
+}
+
+/* every window exists, is 640x480 and not override-redirect */
+static inline xcb_get_window_attributes_cookie_t be_attr_get(
+		xcb_connection_t *xc, Window win)
+{
+	xcb_get_window_attributes_cookie_t ac = { 0 };
+
+	be_null.req++;
+	return ac;
+}
+
+static inline xcb_get_window_attributes_reply_t *be_attr_reply(
+		xcb_connection_t *xc, xcb_get_window_attributes_cookie_t ac)
+{
+	return calloc(1, sizeof(xcb_get_window_attributes_reply_t));
+}
+
+static inline xcb_get_geometry_cookie_t be_geom_get(xcb_connection_t *xc,
+		Window win)
+{
+	xcb_get_geometry_cookie_t gc = { 0 };
+
+	be_null.req++;
+	return gc;
+}
+
+static inline xcb_get_geometry_reply_t *be_geom_reply(xcb_connection_t *xc,
+		xcb_get_geometry_cookie_t gc)
+{
+	xcb_get_geometry_reply_t *gr = calloc(1, sizeof(*gr));
+
+	if (gr) {
+		gr->width = 640;
+		gr->height = 480;
+	}
+	return gr;
+}
+
+static inline void be_select(Display *dpy, Window win, long mask)
+{
+	be_null.req++;
+}
+
+static inline void be_sync(Display *dpy)
+{
+	be_null.req++;
+	be_null.sync++;
+}
+
+static inline uint64_t be_seq(Display *dpy)
+{
+	return be_null.req;
+}
+
+static inline int be_fd(Display *dpy)
+{
+	return -1;
+}
+
+static inline int be_pending(Display *dpy)
+{
+	return 0;
+}
+
+static inline void be_next(Display *dpy, XEvent *ev)
+{
+	memset(ev, 0, sizeof(*ev));
+}
@@ -0,0 +1,182 @@
+/*
+ * XCB backend: window requests are written straight into the XCB
+ * connection underneath Xlib (XGetXCBConnection()), so they share its
+ * sequence numbers and error handler but skip Xlib's request packing.
+ * Events are still read through Xlib: the rest of pico.c speaks XEvent,
+ * and an xcb_poll_for_event() here would take events away from Xlib's
+ * queue.  Build with -DBACKEND_XCB and -lX11-xcb.
+ */
+#include <stdlib.h>
+#include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+
+#define BACKEND_NAME	"xcb"
+
+static uint64_t be_xc_req;	/* requests on the property connection */
+
+static inline void be_configure(Display *dpy, Window win, unsigned int mask,
+				XWindowChanges *wc)
+{
+	uint32_t v[7];
+	int n = 0;
+
+	/* XCB wants the values in mask bit order, which CW* share */
+	if (mask & CWX)
+		v[n++] = wc->x;
+	if (mask & CWY)
+		v[n++] = wc->y;
+	if (mask & CWWidth)
+		v[n++] = wc->width;
+	if (mask & CWHeight)
+		v[n++] = wc->height;
+	if (mask & CWBorderWidth)
+		v[n++] = wc->border_width;
+	if (mask & CWSibling)
+		v[n++] = wc->sibling;
+	if (mask & CWStackMode)
+		v[n++] = wc->stack_mode;
+	xcb_configure_window(XGetXCBConnection(dpy), win, mask & 0x7f, v);
+}
+
+static inline void be_move(Display *dpy, Window win, int x, int y)
+{
+	const uint32_t v[] = { x, y };
+
+	xcb_configure_window(XGetXCBConnection(dpy), win,
+		XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y, v);
+}
+
+static inline void be_resize(Display *dpy, Window win, unsigned int w,
+			     unsigned int h)
+{
+	const uint32_t v[] = { w, h };
+
+	xcb_configure_window(XGetXCBConnection(dpy), win,
+		XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, v);
+}
+
+static inline void be_moveresize(Display *dpy, Window win, int x, int y,
+				 unsigned int w, unsigned int h)
+{
+	const uint32_t v[] = { x, y, w, h };
+
+	xcb_configure_window(XGetXCBConnection(dpy), win,
+		XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+		XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, v);
+}
+
+static inline void be_map(Display *dpy, Window win)
+{
+	xcb_map_window(XGetXCBConnection(dpy), win);
+}
+
+static inline void be_unmap(Display *dpy, Window win)
+{
+	xcb_unmap_window(XGetXCBConnection(dpy), win);
+}
+
+static inline void be_raise(Display *dpy, Window win)
+{
+	const uint32_t v[] = { XCB_STACK_MODE_ABOVE };
+
+	xcb_configure_window(XGetXCBConnection(dpy), win,
+		XCB_CONFIG_WINDOW_STACK_MODE, v);
+}
+
+static inline void be_focus(Display *dpy, Window win)
+{
+	xcb_set_input_focus(XGetXCBConnection(dpy),
+		XCB_INPUT_FOCUS_POINTER_ROOT, win, XCB_CURRENT_TIME);
+}
+
+/* XEvent and xcb's 32-byte wire events differ; let Xlib encode it */
+static inline void be_send(Display *dpy, Window win, long mask, XEvent *ev)
+{
+	XSendEvent(dpy, win, False, mask, ev);
+}
+
+static inline xcb_get_property_cookie_t be_prop_get(xcb_connection_t *xc,
+		Window win, Atom prop, Atom type, uint32_t len)
+{
+	be_xc_req++;
+	return xcb_get_property(xc, 0, win, prop, type, 0, len);
+}
+
+/* errors are taken and freed here: on xc nothing would ever read them */
+static inline xcb_get_property_reply_t *be_prop_reply(xcb_connection_t *xc,
+		xcb_get_property_cookie_t pc)
+{
+	xcb_generic_error_t *err = NULL;
+	xcb_get_property_reply_t *r = xcb_get_property_reply(xc, pc, &err);
+
+	free(err);
+	return r;
+}
+
+static inline xcb_get_window_attributes_cookie_t be_attr_get(
+		xcb_connection_t *xc, Window win)
+{
+	be_xc_req++;
+	return xcb_get_window_attributes(xc, win);
+}
+
+static inline xcb_get_window_attributes_reply_t *be_attr_reply(
+		xcb_connection_t *xc, xcb_get_window_attributes_cookie_t ac)
+{
+	xcb_generic_error_t *err = NULL;
+	xcb_get_window_attributes_reply_t *r =
+		xcb_get_window_attributes_reply(xc, ac, &err);
+
+	free(err);
+	return r;
+}
+
+static inline xcb_get_geometry_cookie_t be_geom_get(xcb_connection_t *xc,
+		Window win)
+{
+	be_xc_req++;
+	return xcb_get_geometry(xc, win);
+}
+
+static inline xcb_get_geometry_reply_t *be_geom_reply(xcb_connection_t *xc,
+		xcb_get_geometry_cookie_t gc)
+{
+	xcb_generic_error_t *err = NULL;
+	xcb_get_geometry_reply_t *r = xcb_get_geometry_reply(xc, gc, &err);
+
+	free(err);
+	return r;
+}
+
+static inline void be_select(Display *dpy, Window win, long mask)
+{
+	XSelectInput(dpy, win, mask);
+}
+
+static inline void be_sync(Display *dpy)
+{
+	/* XSync() also drains Xlib's queue, which the events still use */
+	XSync(dpy, False);
+}
+
+/* requests issued so far, on both connections */
+static inline uint64_t be_seq(Display *dpy)
+{
+	return XNextRequest(dpy) - 1 + be_xc_req;
+}
+
+static inline int be_fd(Display *dpy)
+{
+	return ConnectionNumber(dpy);
+}
+
+static inline int be_pending(Display *dpy)
+{
+	return XPending(dpy);
+}
+
+static inline void be_next(Display *dpy, XEvent *ev)
+{
+	XNextEvent(dpy, ev);
+}